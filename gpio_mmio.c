@@ -0,0 +1,188 @@
+// gpio_mmio.c - Memory-mapped BCM283x/BCM2711 GPIO register access
+#include "gpio_mmio.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define GPIO_PUD_UP             2       // BCM283x GPPUD value for pull-up
+#define GPIO_PUP_PDN_UP         1       // BCM2711 PUP_PDN value for pull-up
+#define GPIO_PUD_SETTLE_US      5       // BCM283x pull control setup/hold time
+
+// GPFSEL and pull registers are read-modify-written and shared by all pins
+// in them, whichever bus or thread owns the pin: serialize every update
+static pthread_mutex_t reg_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Recompute GPLEV0 of a fake register block: a pin reads low only while it
+// is an output with a cleared latch, otherwise the (virtual) pull-up wins
+static void fake_update_levels(GPIO_MMIO *gpio) {
+    uint32_t levels = 0xFFFFFFFF;
+
+    for (int pin = 0; pin <= GPIO_MMIO_MAX_PIN; pin++) {
+        uint32_t fsel = (gpio->regs[GPIO_REG_GPFSEL0 + pin / 10] >> ((pin % 10) * 3)) & 7;
+        if (fsel == GPIO_FSEL_OUTPUT && !(gpio->latch & (1u << pin))) {
+            levels &= ~(1u << pin);
+        }
+    }
+    gpio->regs[GPIO_REG_GPLEV0] = levels;
+}
+
+int gpio_mmio_open(GPIO_MMIO *gpio, const char *path, int allow_fake) {
+    struct stat st;
+
+    memset(gpio, 0, sizeof(*gpio));
+    gpio->fd = open(path, O_RDWR | O_SYNC | (allow_fake ? O_CREAT : 0), 0644);
+    if (gpio->fd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (fstat(gpio->fd, &st) < 0) {
+        fprintf(stderr, "Failed to stat %s: %s\n", path, strerror(errno));
+        close(gpio->fd);
+        return -1;
+    }
+
+    // A regular file stands in for the register block, if one was asked for
+    if (S_ISREG(st.st_mode) && !allow_fake) {
+        fprintf(stderr, "%s is a regular file, not a GPIO register block\n", path);
+        close(gpio->fd);
+        return -1;
+    }
+    if (S_ISREG(st.st_mode)) {
+        gpio->fake = 1;
+        if (st.st_size < GPIO_MMIO_BLOCK_SIZE && ftruncate(gpio->fd, GPIO_MMIO_BLOCK_SIZE) < 0) {
+            fprintf(stderr, "Failed to size %s: %s\n", path, strerror(errno));
+            close(gpio->fd);
+            return -1;
+        }
+    }
+
+    void *map = mmap(NULL, GPIO_MMIO_BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, gpio->fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", path, strerror(errno));
+        close(gpio->fd);
+        return -1;
+    }
+    gpio->regs = (volatile uint32_t *)map;
+    gpio->bcm2711 = gpio->regs[GPIO_REG_PUP_PDN3] != GPIO_BCM283X_MAGIC;
+
+    if (gpio->fake) {
+        fake_update_levels(gpio);
+    }
+
+    return 0;
+}
+
+void gpio_mmio_close(GPIO_MMIO *gpio) {
+    if (gpio->regs) {
+        munmap((void *)gpio->regs, GPIO_MMIO_BLOCK_SIZE);
+        close(gpio->fd);
+        gpio->regs = NULL;
+        gpio->fd = -1;
+    }
+}
+
+// Set the function of every pin in the mask, one read-modify-write per
+// GPFSEL register touched
+void gpio_mmio_set_function(GPIO_MMIO *gpio, uint32_t pins, int function) {
+    pthread_mutex_lock(&reg_lock);
+    for (int reg = 0; reg * 10 <= GPIO_MMIO_MAX_PIN; reg++) {
+        uint32_t group = (pins >> (reg * 10)) & 0x3FF;
+        if (!group) {
+            continue;
+        }
+
+        uint32_t value = gpio->regs[GPIO_REG_GPFSEL0 + reg];
+        for (int i = 0; i < 10; i++) {
+            if (group & (1u << i)) {
+                value &= ~(7u << (i * 3));
+                value |= (uint32_t)function << (i * 3);
+            }
+        }
+        gpio->regs[GPIO_REG_GPFSEL0 + reg] = value;
+    }
+
+    if (gpio->fake) {
+        fake_update_levels(gpio);
+    }
+    pthread_mutex_unlock(&reg_lock);
+}
+
+void gpio_mmio_set_pull_up(GPIO_MMIO *gpio, uint32_t pins) {
+    pthread_mutex_lock(&reg_lock);
+    if (gpio->bcm2711) {
+        for (int pin = 0; pin <= GPIO_MMIO_MAX_PIN; pin++) {
+            if (!(pins & (1u << pin))) {
+                continue;
+            }
+            int reg = GPIO_REG_PUP_PDN0 + pin / 16;
+            int shift = (pin % 16) * 2;
+            gpio->regs[reg] = (gpio->regs[reg] & ~(3u << shift)) | ((uint32_t)GPIO_PUP_PDN_UP << shift);
+        }
+        pthread_mutex_unlock(&reg_lock);
+        return;
+    }
+
+    // BCM283x: latch the pull setting into the selected pins with the clock register
+    gpio->regs[GPIO_REG_GPPUD] = GPIO_PUD_UP;
+    usleep(GPIO_PUD_SETTLE_US);
+    gpio->regs[GPIO_REG_GPPUDCLK0] = pins;
+    usleep(GPIO_PUD_SETTLE_US);
+    gpio->regs[GPIO_REG_GPPUD] = 0;
+    gpio->regs[GPIO_REG_GPPUDCLK0] = 0;
+    pthread_mutex_unlock(&reg_lock);
+}
+
+uint32_t gpio_mmio_read_levels(GPIO_MMIO *gpio) {
+    return gpio->regs[GPIO_REG_GPLEV0];
+}
+
+void gpio_mmio_open_drain_init(GPIO_MMIO *gpio, uint32_t pins) {
+    gpio_mmio_set_pull_up(gpio, pins);
+    gpio_mmio_set_function(gpio, pins, GPIO_FSEL_INPUT);
+
+    // With the latch cleared, switching a pin to output drives it low
+    pthread_mutex_lock(&reg_lock);
+    gpio->regs[GPIO_REG_GPCLR0] = pins;
+    gpio->latch &= ~pins;
+
+    if (gpio->fake) {
+        fake_update_levels(gpio);
+    }
+    pthread_mutex_unlock(&reg_lock);
+}
+
+void gpio_mmio_open_drain_write(GPIO_MMIO *gpio, uint32_t pins, uint32_t levels) {
+    uint32_t low = pins & ~levels;
+    uint32_t high = pins & levels;
+
+    // Pins in one GPFSEL register are switched in a single write
+    pthread_mutex_lock(&reg_lock);
+    for (int reg = 0; reg * 10 <= GPIO_MMIO_MAX_PIN; reg++) {
+        uint32_t group_low = (low >> (reg * 10)) & 0x3FF;
+        uint32_t group_high = (high >> (reg * 10)) & 0x3FF;
+        if (!group_low && !group_high) {
+            continue;
+        }
+
+        uint32_t value = gpio->regs[GPIO_REG_GPFSEL0 + reg];
+        for (int i = 0; i < 10; i++) {
+            if (group_low & (1u << i)) {
+                value = (value & ~(7u << (i * 3))) | ((uint32_t)GPIO_FSEL_OUTPUT << (i * 3));
+            } else if (group_high & (1u << i)) {
+                value &= ~(7u << (i * 3));
+            }
+        }
+        gpio->regs[GPIO_REG_GPFSEL0 + reg] = value;
+    }
+
+    if (gpio->fake) {
+        fake_update_levels(gpio);
+    }
+    pthread_mutex_unlock(&reg_lock);
+}
@@ -0,0 +1,54 @@
+// gpio_mmio.h - Memory-mapped BCM283x/BCM2711 GPIO register access
+#ifndef GPIO_MMIO_H
+#define GPIO_MMIO_H
+
+#include <stdint.h>
+
+#define GPIO_MMIO_DEVICE        "/dev/gpiomem"  // GPIO register block, no root needed
+#define GPIO_MMIO_BLOCK_SIZE    4096            // Size of the mapped register block
+#define GPIO_MMIO_MAX_PIN       31              // Only bank 0 (GPIO0-31) is supported
+
+// Register offsets within the GPIO block, in 32-bit words
+#define GPIO_REG_GPFSEL0        (0x00 / 4)      // Function select, 10 pins per register
+#define GPIO_REG_GPSET0         (0x1C / 4)      // Output set
+#define GPIO_REG_GPCLR0         (0x28 / 4)      // Output clear
+#define GPIO_REG_GPLEV0         (0x34 / 4)      // Pin level
+#define GPIO_REG_GPPUD          (0x94 / 4)      // BCM283x pull-up/down enable
+#define GPIO_REG_GPPUDCLK0      (0x98 / 4)      // BCM283x pull-up/down clock
+#define GPIO_REG_PUP_PDN0       (0xE4 / 4)      // BCM2711 pull control, 16 pins per register
+#define GPIO_REG_PUP_PDN3       (0xF0 / 4)      // Reads GPIO_BCM283X_MAGIC on BCM283x
+
+#define GPIO_BCM283X_MAGIC      0x6770696f      // "gpio": unimplemented register on BCM283x
+
+#define GPIO_FSEL_INPUT         0
+#define GPIO_FSEL_OUTPUT        1
+
+typedef struct {
+    volatile uint32_t *regs;  // Mapped register block
+    int fd;
+    int fake;                 // Backed by a regular file instead of /dev/gpiomem
+    int bcm2711;              // Pi 4 style pull control registers
+    uint32_t latch;           // Output latch shadow (GPSET/GPCLR are write-only)
+} GPIO_MMIO;
+
+// Map the GPIO register block. With allow_fake, path may also be a regular
+// file, which is created/extended to GPIO_MMIO_BLOCK_SIZE and used as a
+// fake register block whose GPLEV0 follows the pins driven through it.
+// Without it, path must be the real device.
+int gpio_mmio_open(GPIO_MMIO *gpio, const char *path, int allow_fake);
+void gpio_mmio_close(GPIO_MMIO *gpio);
+
+// Raw register helpers
+void gpio_mmio_set_function(GPIO_MMIO *gpio, uint32_t pins, int function);
+void gpio_mmio_set_pull_up(GPIO_MMIO *gpio, uint32_t pins);
+uint32_t gpio_mmio_read_levels(GPIO_MMIO *gpio);
+
+// Open-drain emulation: pins in the mask get a cleared output latch and a
+// pull-up and start released (input). Driving low switches a pin to output,
+// releasing switches it back to input; pins sharing a GPFSEL register are
+// switched with a single register write. Register updates are serialized
+// within the process, so threads may drive pins of the same block.
+void gpio_mmio_open_drain_init(GPIO_MMIO *gpio, uint32_t pins);
+void gpio_mmio_open_drain_write(GPIO_MMIO *gpio, uint32_t pins, uint32_t levels);
+
+#endif // GPIO_MMIO_H
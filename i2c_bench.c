@@ -0,0 +1,339 @@
+// i2c_bench.c - Throughput and latency benchmark of the soft I2C stack
+//
+// Starts the slave on a private simulated wire and drives it back to back,
+// with none of the master's pacing delays, in three phases per bit delay:
+// register writes, register reads and full measurement cycles (start,
+// interrupt status, then range status and distance in one burst). Each phase reports its rate,
+// raw bytes per second on the bus, latency percentiles and the fraction
+// of the limit implied by the bit delay, i.e. of the rate an ideal bus
+// with no overhead beyond the master's bit delays would reach. The result
+// is one JSON document, so runs can be compared across commits. With -w
+// the master and the slave use a wide bus, measuring that many sensors
+// with every transfer; byte rates then count the bytes of every line.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "soft_i2c.h"
+#include "i2c_stats.h"
+#include "vl53l0x_io.h"
+
+#define BENCH_DEFAULT_BIT_DELAYS "50,100,200,500"
+#define BENCH_DEFAULT_OPS       50      // Operations per phase
+#define BENCH_DEFAULT_SLAVE     "./vl53l0x_slave"
+#define BENCH_SETTLE_MS         300     // Time for the slave to attach before the master starts
+#define BENCH_STOP_TIMEOUT_MS   2000    // Grace period for the slave after SIGINT
+#define BENCH_MAX_BIT_DELAYS    16
+
+// SDA lines of a wide bus (-w), all clocked by SCL_PIN
+static const int wide_pins[I2C_WIDE_MAX] = {SDA_PIN, 5, 6, 12, 13, 16, 20, 21};
+
+// The slave's pacing pauses are off by default, so the stack itself is
+// measured: with them, a START right after a STOP falls into the pause
+#define BENCH_DEFAULT_RETRY_US  0
+#define BENCH_DEFAULT_POST_US   0
+
+// Bus bytes per operation, including the address bytes
+#define BENCH_WRITE_BYTES       3       // Address, register, value
+#define BENCH_READ_BYTES        4       // Address, register, repeated START, address, value
+#define BENCH_RESULT_BYTES      (3 + VL53L0X_RESULT_BLOCK_SIZE)  // Result block burst
+
+typedef struct {
+    const char *name;
+    int (*op)(I2C_Config *config);  // Returns 0 on success
+    int bytes;                      // Bus bytes per operation
+    int delays;                     // Bit delays per operation on an ideal bus
+    int ops;
+    int errors;
+    uint64_t elapsed_ns;
+    I2C_Latency latency;            // Successful operations only
+} BenchPhase;
+
+static volatile int running = 1;
+static int width = 1;  // SDA lines, one sensor each
+
+static void handle_signal(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+static int read_registers(I2C_Config *config, uint8_t reg, uint8_t *values, int count) {
+    return i2c_master_write_read(config, &reg, 1, values, count);
+}
+
+static int op_write(I2C_Config *config) {
+    uint8_t data[2] = {VL53L0X_REG_SYSRANGE_START, 0x01};
+    return i2c_master_write(config, data, 2);
+}
+
+// Reads fill one value (or block) per SDA line; every line must check out
+static int op_read(I2C_Config *config) {
+    uint8_t model_id[I2C_WIDE_MAX];
+    if (read_registers(config, VL53L0X_REG_IDENTIFICATION_MODEL_ID, model_id, 1) < 0) {
+        return -1;
+    }
+    for (int n = 0; n < width; n++) {
+        if (model_id[n] != VL53L0X_MODEL_ID) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int op_cycle(I2C_Config *config) {
+    uint8_t interrupt_status[I2C_WIDE_MAX], blocks[I2C_WIDE_MAX][VL53L0X_RESULT_BLOCK_SIZE];
+    int offset = VL53L0X_REG_RESULT_RANGE_VAL - VL53L0X_REG_RESULT_RANGE_STATUS;
+
+    if (op_write(config) < 0 ||
+        read_registers(config, VL53L0X_REG_RESULT_INTERRUPT_STATUS, interrupt_status, 1) < 0 ||
+        read_registers(config, VL53L0X_REG_RESULT_RANGE_STATUS, blocks[0], sizeof(blocks[0])) < 0) {
+        return -1;
+    }
+    for (int n = 0; n < width; n++) {
+        if ((interrupt_status[n] & ~VL53L0X_INT_STATUS_MASK) ||
+            ((blocks[n][offset] << 8) | blocks[n][offset + 1]) > VL53L0X_MAX_DISTANCE_MM) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void run_phase(I2C_Config *config, BenchPhase *phase, int count) {
+    uint64_t phase_start = i2c_now_ns();
+
+    for (int i = 0; i < count && running; i++) {
+        uint64_t start = i2c_now_ns();
+        if (phase->op(config) == 0) {
+            i2c_latency_add(&phase->latency, i2c_now_ns() - start);
+        } else {
+            phase->errors++;
+        }
+        phase->ops++;
+    }
+    phase->elapsed_ns = i2c_now_ns() - phase_start;
+}
+
+static pid_t start_slave(const char *slave, const char *wire, int bit_delay,
+                         int retry_delay_us, int post_delay_us) {
+    char bit[16], retry[16], post[16], lines[8 * I2C_WIDE_MAX];
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_RDWR);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        snprintf(bit, sizeof(bit), "%d", bit_delay);
+        snprintf(retry, sizeof(retry), "%d", retry_delay_us);
+        snprintf(post, sizeof(post), "%d", post_delay_us);
+        if (width > 1) {
+            int length = 0;
+            for (int n = 0; n < width; n++) {
+                length += snprintf(lines + length, sizeof(lines) - length, "%s%d", n ? "," : "", wide_pins[n]);
+            }
+            execl(slave, slave, "-b", "sim", "-d", wire, "-t", bit, "-y", retry, "-P", post,
+                  "-W", lines, (char *)NULL);
+        } else {
+            execl(slave, slave, "-b", "sim", "-d", wire, "-t", bit, "-y", retry, "-P", post,
+                  (char *)NULL);
+        }
+        _exit(127);
+    }
+    return pid;
+}
+
+static void stop_slave(pid_t pid) {
+    kill(pid, SIGINT);
+    for (int waited = 0; waited < BENCH_STOP_TIMEOUT_MS; waited += 10) {
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            return;
+        }
+        usleep(10000);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+static double per_second(double count, uint64_t ns) {
+    return ns ? count * 1e9 / ns : 0.0;
+}
+
+static void print_phase(FILE *out, BenchPhase *phase, int bit_delay) {
+    double ops_per_s = per_second(phase->ops - phase->errors, phase->elapsed_ns);
+    double limit_ops_per_s = 1e6 / ((double)phase->delays * bit_delay);
+
+    fprintf(out, "\"%s\":{\"ops\":%d,\"errors\":%d,\"elapsed_s\":%.3f,\"ops_per_s\":%.2f,"
+                 "\"bytes_per_s\":%.1f,\"limit_ops_per_s\":%.2f,\"efficiency\":%.4f,"
+                 "\"latency_us\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f}}",
+            phase->name, phase->ops, phase->errors, phase->elapsed_ns / 1e9, ops_per_s,
+            ops_per_s * phase->bytes * width, limit_ops_per_s, ops_per_s / limit_ops_per_s,
+            i2c_latency_percentile(&phase->latency, 50) / 1000.0,
+            i2c_latency_percentile(&phase->latency, 90) / 1000.0,
+            i2c_latency_percentile(&phase->latency, 99) / 1000.0,
+            i2c_latency_percentile(&phase->latency, 100) / 1000.0);
+}
+
+// Benchmark one bit delay and print its JSON object; returns -1 if the
+// master could not be set up
+static int bench_bit_delay(FILE *out, const char *slave, const char *wire, int bit_delay,
+                           int ops, int retry_delay_us, int post_delay_us) {
+    int read_delays = i2c_master_write_read_delays(1, 1);
+    BenchPhase phases[] = {
+        { .name = "write", .op = op_write, .bytes = BENCH_WRITE_BYTES,
+          .delays = i2c_master_write_delays(2) },
+        { .name = "read", .op = op_read, .bytes = BENCH_READ_BYTES, .delays = read_delays },
+        { .name = "cycle", .op = op_cycle,
+          .bytes = BENCH_WRITE_BYTES + BENCH_READ_BYTES + BENCH_RESULT_BYTES,
+          .delays = i2c_master_write_delays(2) + read_delays +
+                    i2c_master_write_read_delays(1, VL53L0X_RESULT_BLOCK_SIZE) },
+    };
+    int n_phases = sizeof(phases) / sizeof(phases[0]);
+    I2C_Config config;
+    uint64_t total_ns = 0;
+    double total_bytes = 0;
+    double total_delays = 0;  // Bit delays the same work takes on an ideal bus
+
+    unlink(wire);
+    pid_t pid = start_slave(slave, wire, bit_delay, retry_delay_us, post_delay_us);
+    if (pid < 0) {
+        fprintf(stderr, "Failed to start slave: %s\n", strerror(errno));
+        return -1;
+    }
+    usleep(BENCH_SETTLE_MS * 1000);
+
+    memset(&config, 0, sizeof(config));
+    i2c_set_backend(&config, "sim");
+    config.device = wire;
+    config.sda_pin = SDA_PIN;
+    config.scl_pin = SCL_PIN;
+    config.slave_address = VL53L0X_ADDR;
+    config.bit_delay = bit_delay;
+    if (width > 1) {
+        config.width = width;
+        memcpy(config.sda_pins, wide_pins, sizeof(wide_pins));
+    }
+    if (i2c_init(&config) < 0) {
+        stop_slave(pid);
+        return -1;
+    }
+
+    for (int i = 0; i < n_phases; i++) {
+        i2c_latency_init(&phases[i].latency);
+        fprintf(stderr, "bit delay %d us: %s...\n", bit_delay, phases[i].name);
+        run_phase(&config, &phases[i], ops);
+        total_ns += phases[i].elapsed_ns;
+        total_bytes += (double)(phases[i].ops - phases[i].errors) * phases[i].bytes * width;
+        total_delays += (double)(phases[i].ops - phases[i].errors) * phases[i].delays;
+    }
+
+    i2c_cleanup(&config);
+    stop_slave(pid);
+
+    fprintf(out, "{\"bit_delay_us\":%d,\"raw_bytes_per_s\":%.1f,\"register_reads_per_s\":%.2f,"
+                 "\"cycles_per_s\":%.2f,\"samples_per_s\":%.2f,\"limit_bytes_per_s\":%.1f,\"phases\":{",
+            bit_delay, per_second(total_bytes, total_ns),
+            per_second(phases[1].ops - phases[1].errors, phases[1].elapsed_ns),
+            per_second(phases[2].ops - phases[2].errors, phases[2].elapsed_ns),
+            per_second((double)(phases[2].ops - phases[2].errors) * width, phases[2].elapsed_ns),
+            total_delays > 0 ? 1e6 * total_bytes / (total_delays * bit_delay) : 0.0);
+    for (int i = 0; i < n_phases; i++) {
+        print_phase(out, &phases[i], bit_delay);
+        fprintf(out, "%s", i + 1 < n_phases ? "," : "");
+        i2c_latency_free(&phases[i].latency);
+    }
+    fprintf(out, "}}");
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-t list] [-n ops] [-w lines] [-y us] [-P us] [-s slave] [-l label]\n"
+                    "          [-o file]\n", prog);
+    fprintf(stderr, "  -t  Bit delays in us, comma separated (default: %s)\n", BENCH_DEFAULT_BIT_DELAYS);
+    fprintf(stderr, "  -n  Operations per phase (default: %d)\n", BENCH_DEFAULT_OPS);
+    fprintf(stderr, "  -w  Wide bus of 2-%d SDA lines, one sensor each (default: 1 line)\n", I2C_WIDE_MAX);
+    fprintf(stderr, "  -y  Slave retry delay in us (default: %d)\n", BENCH_DEFAULT_RETRY_US);
+    fprintf(stderr, "  -P  Slave post-transaction delay in us (default: %d)\n", BENCH_DEFAULT_POST_US);
+    fprintf(stderr, "  -s  Slave binary (default: %s)\n", BENCH_DEFAULT_SLAVE);
+    fprintf(stderr, "  -l  Label stored with the results, e.g. a commit id\n");
+    fprintf(stderr, "  -o  Output file (default: stdout)\n");
+}
+
+int main(int argc, char *argv[]) {
+    int bit_delays[BENCH_MAX_BIT_DELAYS];
+    int n_bit_delays = 0;
+    const char *bit_list = BENCH_DEFAULT_BIT_DELAYS;
+    const char *slave = BENCH_DEFAULT_SLAVE;
+    const char *label = "";
+    const char *output = NULL;
+    int ops = BENCH_DEFAULT_OPS;
+    int retry_delay_us = BENCH_DEFAULT_RETRY_US;
+    int post_delay_us = BENCH_DEFAULT_POST_US;
+    char wire[64];
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:w:y:P:s:l:o:h")) != -1) {
+        switch (opt) {
+        case 't': bit_list = optarg; break;
+        case 'n': ops = atoi(optarg); break;
+        case 'w': width = atoi(optarg); break;
+        case 'y': retry_delay_us = atoi(optarg); break;
+        case 'P': post_delay_us = atoi(optarg); break;
+        case 's': slave = optarg; break;
+        case 'l': label = optarg; break;
+        case 'o': output = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    for (const char *p = bit_list; *p; ) {
+        char *end;
+        long v = strtol(p, &end, 10);
+        if (end == p || v <= 0 || n_bit_delays == BENCH_MAX_BIT_DELAYS || (*end && *end != ',')) {
+            fprintf(stderr, "Bad bit delay list %s\n", bit_list);
+            return 1;
+        }
+        bit_delays[n_bit_delays++] = (int)v;
+        p = *end ? end + 1 : end;
+    }
+    if (ops <= 0 || n_bit_delays == 0 || width < 1 || width > I2C_WIDE_MAX) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // The I2C layer logs to stdout; keep that free for the results
+    FILE *out = output ? fopen(output, "w") : fdopen(dup(STDOUT_FILENO), "w");
+    if (!out) {
+        fprintf(stderr, "Failed to open %s: %s\n", output ? output : "stdout", strerror(errno));
+        return 1;
+    }
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    snprintf(wire, sizeof(wire), "/dev/shm/i2c_bench_%d", (int)getpid());
+
+    fprintf(out, "{\"label\":\"%s\",\"backend\":\"sim\",\"ops_per_phase\":%d,\"sda_lines\":%d,"
+                 "\"slave\":{\"retry_delay_us\":%d,\"post_delay_us\":%d},\"runs\":[",
+            label, ops, width, retry_delay_us, post_delay_us);
+    int result = 0;
+    for (int i = 0; i < n_bit_delays && running; i++) {
+        if (i > 0) {
+            fprintf(out, ",");
+        }
+        if (bench_bit_delay(out, slave, wire, bit_delays[i], ops, retry_delay_us, post_delay_us) < 0) {
+            result = 1;
+            break;
+        }
+    }
+    fprintf(out, "]}\n");
+    fclose(out);
+    unlink(wire);
+
+    return result || !running;
+}
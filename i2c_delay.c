@@ -0,0 +1,126 @@
+// i2c_delay.c - Calibrated high-resolution delays for soft I2C bit timing
+#include "i2c_delay.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#define I2C_DELAY_CLOCK_SAMPLES 1000   // clock_gettime() calls timed at calibration
+#define I2C_DELAY_SLEEP_SAMPLES 50     // Sleeps timed at calibration
+#define I2C_DELAY_SLEEP_PROBE_NS 50000 // Length of each calibration sleep
+#define I2C_DELAY_MARGIN_GROW   4      // Margin moves 1/4 towards a later wakeup
+#define I2C_DELAY_MARGIN_DECAY  64     // and 1/64 towards an earlier one
+
+// Tell the core we are spinning (frees the pipeline for an SMT sibling)
+#if defined(__aarch64__) || defined(__arm__)
+#define cpu_relax() __asm__ volatile("yield" ::: "memory")
+#elif defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __asm__ volatile("pause" ::: "memory")
+#else
+#define cpu_relax() __asm__ volatile("" ::: "memory")
+#endif
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_until(int64_t deadline_ns) {
+    struct timespec ts = { deadline_ns / 1000000000LL, deadline_ns % 1000000000LL };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+static int compare_i64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+void i2c_delay_calibrate(I2C_Delay *delay) {
+    int64_t samples[I2C_DELAY_SLEEP_SAMPLES];
+    
+    if (delay->spin_threshold_ns <= 0) {
+        delay->spin_threshold_ns = I2C_DELAY_SPIN_THRESHOLD_NS;
+    }
+    
+    // Cost of reading the clock, which bounds the spin resolution
+    int64_t start = now_ns();
+    for (int i = 0; i < I2C_DELAY_CLOCK_SAMPLES; i++) {
+        now_ns();
+    }
+    delay->clock_read_ns = (now_ns() - start) / I2C_DELAY_CLOCK_SAMPLES;
+    
+    // How late clock_nanosleep wakes up
+    for (int i = 0; i < I2C_DELAY_SLEEP_SAMPLES; i++) {
+        int64_t deadline = now_ns() + I2C_DELAY_SLEEP_PROBE_NS;
+        sleep_until(deadline);
+        samples[i] = now_ns() - deadline;
+    }
+    qsort(samples, I2C_DELAY_SLEEP_SAMPLES, sizeof(samples[0]), compare_i64);
+    delay->sleep_overshoot_ns = samples[I2C_DELAY_SLEEP_SAMPLES / 2];
+    delay->sleep_overshoot_max_ns = samples[I2C_DELAY_SLEEP_SAMPLES - 1];
+    
+    // Wake up early enough for 90% of the sleeps, spin the remainder
+    delay->sleep_margin_ns = samples[I2C_DELAY_SLEEP_SAMPLES * 9 / 10];
+    
+    delay->waits = 0;
+    delay->overshoot_total_ns = 0;
+    delay->overshoot_max_ns = 0;
+    delay->calibrated = 1;
+    
+    printf("Delay engine: clock read %lld ns, sleep overshoot %lld us (max %lld us), "
+           "spinning below %lld us\n",
+           (long long)delay->clock_read_ns, (long long)delay->sleep_overshoot_ns / 1000,
+           (long long)delay->sleep_overshoot_max_ns / 1000,
+           (long long)delay->spin_threshold_ns / 1000);
+}
+
+void i2c_delay_ns(I2C_Delay *delay, int64_t ns) {
+    if (ns <= 0) {
+        return;
+    }
+    
+    int64_t now = now_ns();
+    int64_t deadline = now + ns;
+    
+    if (ns >= delay->spin_threshold_ns && ns > delay->sleep_margin_ns) {
+        int64_t wakeup = deadline - delay->sleep_margin_ns;
+        sleep_until(wakeup);
+        now = now_ns();
+        
+        // Track the wakeup latency, which grows with load and sleep length
+        int64_t latency = now - wakeup;
+        if (latency > delay->sleep_margin_ns) {
+            delay->sleep_margin_ns += (latency - delay->sleep_margin_ns) / I2C_DELAY_MARGIN_GROW;
+        } else {
+            delay->sleep_margin_ns -= (delay->sleep_margin_ns - latency) / I2C_DELAY_MARGIN_DECAY;
+        }
+    }
+    while (now < deadline) {
+        cpu_relax();
+        now = now_ns();
+    }
+    
+    int64_t overshoot = now - deadline;
+    delay->waits++;
+    delay->overshoot_total_ns += overshoot;
+    if (overshoot > delay->overshoot_max_ns) {
+        delay->overshoot_max_ns = overshoot;
+    }
+}
+
+void i2c_delay_us(I2C_Delay *delay, int us) {
+    i2c_delay_ns(delay, (int64_t)us * 1000);
+}
+
+void i2c_delay_report(const I2C_Delay *delay) {
+    if (delay->waits == 0) {
+        return;
+    }
+    printf("Delay engine: %llu waits, overshoot mean %lld ns, max %lld ns\n",
+           (unsigned long long)delay->waits,
+           (long long)(delay->overshoot_total_ns / (int64_t)delay->waits),
+           (long long)delay->overshoot_max_ns);
+}
@@ -0,0 +1,39 @@
+// i2c_delay.h - Calibrated high-resolution delays for soft I2C bit timing
+#ifndef I2C_DELAY_H
+#define I2C_DELAY_H
+
+#include <stdint.h>
+
+#define I2C_DELAY_SPIN_THRESHOLD_NS 100000  // Default: busy-spin waits shorter than 100us
+
+// Delay engine state. Waits shorter than spin_threshold_ns busy-spin on
+// CLOCK_MONOTONIC; longer ones sleep with clock_nanosleep until the
+// calibrated wakeup latency before the deadline and spin the rest, so the
+// deadline is met without the usual 50-100us sleep overshoot.
+typedef struct {
+    int64_t spin_threshold_ns;  // 0 selects I2C_DELAY_SPIN_THRESHOLD_NS
+    
+    // Calibration (filled by i2c_delay_calibrate)
+    int calibrated;
+    int64_t clock_read_ns;      // Cost of one clock_gettime()
+    int64_t sleep_margin_ns;    // Wake up this long before the deadline (adapts to load)
+    int64_t sleep_overshoot_ns; // Median clock_nanosleep overshoot
+    int64_t sleep_overshoot_max_ns;
+    
+    // Statistics of the waits performed
+    uint64_t waits;
+    int64_t overshoot_total_ns;
+    int64_t overshoot_max_ns;
+} I2C_Delay;
+
+// Measure clock and sleep latency of this machine and print the result
+void i2c_delay_calibrate(I2C_Delay *delay);
+
+// Wait ns/us nanoseconds/microseconds from now
+void i2c_delay_ns(I2C_Delay *delay, int64_t ns);
+void i2c_delay_us(I2C_Delay *delay, int us);
+
+// Print the overshoot statistics of the waits so far
+void i2c_delay_report(const I2C_Delay *delay);
+
+#endif // I2C_DELAY_H
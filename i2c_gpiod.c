@@ -0,0 +1,475 @@
+// i2c_gpiod.c - libgpiod line backend for soft I2C
+#include "soft_i2c.h"
+#include <gpiod.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+// Line indices within the SDA/SCL bulk request; on a wide bus SDA lines
+// 1..width-1 follow from I2C_LINE_SDA_WIDE on
+#define I2C_LINE_SDA 0
+#define I2C_LINE_SCL 1
+#define I2C_LINE_SDA_WIDE 2
+#define I2C_LINE_COUNT (I2C_LINE_SDA_WIDE + I2C_WIDE_MAX - 1)
+
+#define I2C_EVENT_BATCH 32  // Kernel events read per line per call
+
+typedef struct {
+    struct gpiod_chip *chip;
+    struct gpiod_line *sda_line;
+    struct gpiod_line *scl_line;
+    struct gpiod_line_bulk lines;  // SDA and SCL requested together
+    int width;                     // SDA lines in the request
+
+    // Edge event mode: both lines are event inputs; SDA is re-requested as
+    // open-drain output only while the slave drives it, since libgpiod v1
+    // cannot drive a line that is requested for events. A read transfer
+    // keeps the output request, released, through the master's ACKs.
+    int events;
+    int sda_output;  // SDA currently requested as output
+    int sda_level;   // Levels tracked from events
+    int scl_level;
+
+    const char *consumer;  // Given to open, for every line we request
+
+    // Auxiliary lines, each requested on its own
+    struct gpiod_line *aux[I2C_AUX_MAX];
+    int aux_pin[I2C_AUX_MAX];
+    int aux_count;
+} GpiodLines;
+
+// Open the chip named by config->device, or the first Pi GPIO chip
+static struct gpiod_chip *open_chip(I2C_Config *config) {
+    struct gpiod_chip *chip;
+
+    if (config->device) {
+        return gpiod_chip_open_lookup(config->device);
+    }
+
+    chip = gpiod_chip_open_by_name("gpiochip0");
+    if (!chip) {
+        chip = gpiod_chip_open_by_name("gpiochip1");
+    }
+    return chip;
+}
+
+// Request SDA and SCL together as one open-drain bulk request with pull-up,
+// both initially released (high). Writing 1 lets the pull-up raise a line,
+// writing 0 pulls it low, and reading returns the real bus level, so no
+// direction switch is ever needed. Being one request, both lines are
+// sampled and driven by a single ioctl. A wide bus adds its other SDA lines
+// to the same request.
+static int gpiod_open(I2C_Config *config, const char *consumer) {
+    struct gpiod_line_request_config req = {
+        .consumer = consumer,
+        .request_type = GPIOD_LINE_REQUEST_DIRECTION_OUTPUT,
+        .flags = GPIOD_LINE_REQUEST_FLAG_OPEN_DRAIN | GPIOD_LINE_REQUEST_FLAG_BIAS_PULL_UP,
+    };
+    int values[I2C_LINE_COUNT];
+
+    GpiodLines *g = calloc(1, sizeof(*g));
+    if (!g) {
+        return -1;
+    }
+
+    g->consumer = consumer;
+    g->chip = open_chip(config);
+    if (!g->chip) {
+        fprintf(stderr, "Failed to open GPIO chip: %s\n", strerror(errno));
+        free(g);
+        return -1;
+    }
+
+    g->sda_line = gpiod_chip_get_line(g->chip, config->sda_pin);
+    g->scl_line = gpiod_chip_get_line(g->chip, config->scl_pin);
+
+    if (!g->sda_line || !g->scl_line) {
+        fprintf(stderr, "Failed to get GPIO lines\n");
+        gpiod_chip_close(g->chip);
+        free(g);
+        return -1;
+    }
+
+    gpiod_line_bulk_init(&g->lines);
+    gpiod_line_bulk_add(&g->lines, g->sda_line);  // I2C_LINE_SDA
+    gpiod_line_bulk_add(&g->lines, g->scl_line);  // I2C_LINE_SCL
+
+    g->width = config->width > 1 ? config->width : 1;
+    for (int n = 1; n < g->width; n++) {
+        struct gpiod_line *line = gpiod_chip_get_line(g->chip, config->sda_pins[n]);
+        if (!line) {
+            fprintf(stderr, "Failed to get GPIO line %d\n", config->sda_pins[n]);
+            gpiod_chip_close(g->chip);
+            free(g);
+            return -1;
+        }
+        gpiod_line_bulk_add(&g->lines, line);  // I2C_LINE_SDA_WIDE + n - 1
+    }
+    for (int i = 0; i < I2C_LINE_COUNT; i++) {
+        values[i] = 1;
+    }
+
+    if (config->edge_events) {
+        if (gpiod_line_request_bulk_both_edges_events_flags(&g->lines, consumer,
+                                                            GPIOD_LINE_REQUEST_FLAG_BIAS_PULL_UP) < 0) {
+            fprintf(stderr, "Failed to request edge events on SDA/SCL: %s\n", strerror(errno));
+            gpiod_chip_close(g->chip);
+            free(g);
+            return -1;
+        }
+        g->events = 1;
+        g->sda_level = gpiod_line_get_value(g->sda_line);
+        g->scl_level = gpiod_line_get_value(g->scl_line);
+        config->line_priv = g;
+        return 0;
+    }
+
+    if (gpiod_line_request_bulk(&g->lines, &req, values) < 0) {
+        fprintf(stderr, "Failed to configure SDA/SCL lines as open-drain: %s\n", strerror(errno));
+        gpiod_chip_close(g->chip);
+        free(g);
+        return -1;
+    }
+
+    config->line_priv = g;
+    return 0;
+}
+
+static void gpiod_close(I2C_Config *config) {
+    GpiodLines *g = config->line_priv;
+
+    for (int i = 0; i < g->aux_count; i++) {
+        gpiod_line_release(g->aux[i]);
+    }
+    if (g->events) {
+        gpiod_line_release(g->sda_line);
+        gpiod_line_release(g->scl_line);
+    } else {
+        gpiod_line_release_bulk(&g->lines);
+    }
+    gpiod_chip_close(g->chip);
+    free(g);
+    config->line_priv = NULL;
+}
+
+// Lines of a bulk request must always be written together, as the kernel
+// sets every line of the request in one call; the other line keeps its
+// cached level. sda holds the level of SDA line n in bit n.
+static void write_lines(I2C_Config *config, uint32_t sda, int scl) {
+    GpiodLines *g = config->line_priv;
+    int values[I2C_LINE_COUNT];
+
+    values[I2C_LINE_SDA] = sda & 1;
+    values[I2C_LINE_SCL] = scl;
+    for (int n = 1; n < g->width; n++) {
+        values[I2C_LINE_SDA_WIDE + n - 1] = (sda >> n) & 1;
+    }
+    gpiod_line_set_value_bulk(&g->lines, values);
+}
+
+static void gpiod_set_sda(I2C_Config *config, int value) {
+    GpiodLines *g = config->line_priv;
+
+    if (g->events) {
+        if (g->sda_output) {
+            gpiod_line_set_value(g->sda_line, value);
+        }
+        return;
+    }
+    write_lines(config, value, config->scl_out);
+}
+
+// In event mode SCL is input only, so clock stretching is not available
+static void gpiod_set_scl(I2C_Config *config, int value) {
+    GpiodLines *g = config->line_priv;
+
+    if (!g->events) {
+        write_lines(config, g->width > 1 ? config->sda_lines_out : (uint32_t)config->sda_out, value);
+    }
+}
+
+// Event mode only: hand SDA between the edge event request and an
+// open-drain output request
+static void gpiod_set_sda_dir(I2C_Config *config, int dir) {
+    GpiodLines *g = config->line_priv;
+
+    if (!g->events || g->sda_output == (dir == I2C_DIR_OUT)) {
+        return;
+    }
+
+    gpiod_line_release(g->sda_line);
+    if (dir == I2C_DIR_OUT) {
+        struct gpiod_line_request_config req = {
+            .consumer = g->consumer,
+            .request_type = GPIOD_LINE_REQUEST_DIRECTION_OUTPUT,
+            .flags = GPIOD_LINE_REQUEST_FLAG_OPEN_DRAIN | GPIOD_LINE_REQUEST_FLAG_BIAS_PULL_UP,
+        };
+        if (gpiod_line_request(g->sda_line, &req, config->sda_out) < 0) {
+            fprintf(stderr, "Failed to drive SDA: %s\n", strerror(errno));
+            return;
+        }
+        g->sda_output = 1;
+    } else {
+        if (gpiod_line_request_both_edges_events_flags(g->sda_line, g->consumer,
+                                                       GPIOD_LINE_REQUEST_FLAG_BIAS_PULL_UP) < 0) {
+            fprintf(stderr, "Failed to request SDA edge events: %s\n", strerror(errno));
+            return;
+        }
+        g->sda_output = 0;
+        g->sda_level = gpiod_line_get_value(g->sda_line);
+    }
+}
+
+static int gpiod_read_lines(I2C_Config *config, int *sda, int *scl) {
+    GpiodLines *g = config->line_priv;
+    int values[I2C_LINE_COUNT];
+
+    // Event and output requests cannot be read as one bulk
+    if (g->events) {
+        *sda = gpiod_line_get_value(g->sda_line);
+        *scl = gpiod_line_get_value(g->scl_line);
+        return (*sda < 0 || *scl < 0) ? -1 : 0;
+    }
+
+    if (gpiod_line_get_value_bulk(&g->lines, values) < 0) {
+        return -1;
+    }
+    *sda = values[I2C_LINE_SDA];
+    *scl = values[I2C_LINE_SCL];
+    return 0;
+}
+
+// Wide bus: every SDA line is driven and sampled with SCL in one ioctl
+static void gpiod_set_sda_lines(I2C_Config *config, uint32_t levels) {
+    write_lines(config, levels, config->scl_out);
+}
+
+static int gpiod_read_sda_lines(I2C_Config *config, uint32_t *levels, int *scl) {
+    GpiodLines *g = config->line_priv;
+    int values[I2C_LINE_COUNT];
+
+    if (gpiod_line_get_value_bulk(&g->lines, values) < 0) {
+        return -1;
+    }
+    *levels = values[I2C_LINE_SDA];
+    for (int n = 1; n < g->width; n++) {
+        *levels |= (uint32_t)values[I2C_LINE_SDA_WIDE + n - 1] << n;
+    }
+    *scl = values[I2C_LINE_SCL];
+    return 0;
+}
+
+static void gpiod_delay(I2C_Config *config, int us) {
+    i2c_delay_us(&config->timing, us);
+}
+
+// SDA while we hold it as output: low if we pull it, else whatever the
+// master puts on the released line (its ACK)
+static int sda_output_level(I2C_Config *config) {
+    GpiodLines *g = config->line_priv;
+
+    if (config->sda_out == 0) {
+        return 0;
+    }
+    int level = gpiod_line_get_value(g->sda_line);
+    return level < 0 ? 1 : level;
+}
+
+static uint64_t event_ns(const struct gpiod_line_event *ev) {
+    return (uint64_t)ev->ts.tv_sec * 1000000000ULL + ev->ts.tv_nsec;
+}
+
+// While we hold SDA as output its events are off, so the master's ACK
+// cannot come from the event stream. Take one SCL event at a time and read
+// SDA right after it, with nothing in between. This assumes we wake up and
+// read within the SCL high phase that follows the edge, as the master keeps
+// SDA stable only until SCL falls again.
+static int read_scl_edge(I2C_Config *config, I2C_Edge *edge, const struct timespec *timeout) {
+    GpiodLines *g = config->line_priv;
+    struct gpiod_line_event ev;
+
+    int rv = gpiod_line_event_wait(g->scl_line, timeout);
+    if (rv <= 0) {
+        return rv;
+    }
+    if (gpiod_line_event_read(g->scl_line, &ev) < 0) {
+        return -1;
+    }
+    edge->sda = sda_output_level(config);
+    g->scl_level = ev.event_type == GPIOD_LINE_EVENT_RISING_EDGE;
+    edge->scl = g->scl_level;
+    edge->ts_ns = event_ns(&ev);
+    return 1;
+}
+
+// Drain the kernel event queues of SCL and SDA and merge them by timestamp
+// into a stream of line states (SCL edge by edge while we drive SDA)
+static int gpiod_read_edges(I2C_Config *config, I2C_Edge *edges, int max, int timeout_us) {
+    GpiodLines *g = config->line_priv;
+    struct gpiod_line_event scl_ev[I2C_EVENT_BATCH], sda_ev[I2C_EVENT_BATCH];
+    struct gpiod_line_bulk watch, ready;
+    struct timespec timeout = { timeout_us / 1000000, (long)(timeout_us % 1000000) * 1000 };
+    int limit = max / 2 < I2C_EVENT_BATCH ? max / 2 : I2C_EVENT_BATCH;
+    int n_scl = 0, n_sda = 0;
+
+    if (!g->events || limit <= 0) {
+        return -1;
+    }
+    if (g->sda_output) {
+        return read_scl_edge(config, edges, &timeout);
+    }
+
+    gpiod_line_bulk_init(&watch);
+    gpiod_line_bulk_add(&watch, g->scl_line);
+    gpiod_line_bulk_add(&watch, g->sda_line);
+
+    int rv = gpiod_line_event_wait_bulk(&watch, &timeout, &ready);
+    if (rv <= 0) {
+        return rv;
+    }
+
+    for (unsigned int i = 0; i < gpiod_line_bulk_num_lines(&ready); i++) {
+        struct gpiod_line *line = gpiod_line_bulk_get_line(&ready, i);
+        if (line == g->scl_line) {
+            n_scl = gpiod_line_event_read_multiple(line, scl_ev, limit);
+        } else {
+            n_sda = gpiod_line_event_read_multiple(line, sda_ev, limit);
+        }
+    }
+    if (n_scl < 0 || n_sda < 0) {
+        return -1;
+    }
+
+    int n = 0, i = 0, j = 0;
+    while (i < n_scl || j < n_sda) {
+        const struct gpiod_line_event *ev;
+        if (j >= n_sda || (i < n_scl && event_ns(&scl_ev[i]) <= event_ns(&sda_ev[j]))) {
+            ev = &scl_ev[i++];
+            g->scl_level = ev->event_type == GPIOD_LINE_EVENT_RISING_EDGE;
+        } else {
+            ev = &sda_ev[j++];
+            g->sda_level = ev->event_type == GPIOD_LINE_EVENT_RISING_EDGE;
+        }
+        edges[n].ts_ns = event_ns(ev);
+        edges[n].sda = g->sda_level;
+        edges[n].scl = g->scl_level;
+        n++;
+    }
+    return n;
+}
+
+static struct gpiod_line *aux_line(GpiodLines *g, int pin) {
+    for (int i = 0; i < g->aux_count; i++) {
+        if (g->aux_pin[i] == pin) {
+            return g->aux[i];
+        }
+    }
+    return NULL;
+}
+
+// Outputs are open-drain like SDA/SCL; inputs get both edge events, so a
+// wait sleeps in the kernel instead of polling
+static int gpiod_aux_open(I2C_Config *config, int pin, int dir) {
+    GpiodLines *g = config->line_priv;
+    struct gpiod_line *line;
+    int rv;
+
+    if (g->aux_count == I2C_AUX_MAX) {
+        fprintf(stderr, "Too many auxiliary lines\n");
+        return -1;
+    }
+    line = gpiod_chip_get_line(g->chip, pin);
+    if (!line) {
+        fprintf(stderr, "Failed to get GPIO line %d\n", pin);
+        return -1;
+    }
+
+    if (dir == I2C_DIR_OUT) {
+        struct gpiod_line_request_config req = {
+            .consumer = g->consumer,
+            .request_type = GPIOD_LINE_REQUEST_DIRECTION_OUTPUT,
+            .flags = GPIOD_LINE_REQUEST_FLAG_OPEN_DRAIN | GPIOD_LINE_REQUEST_FLAG_BIAS_PULL_UP,
+        };
+        rv = gpiod_line_request(line, &req, 1);
+    } else {
+        rv = gpiod_line_request_both_edges_events_flags(line, g->consumer,
+                                                        GPIOD_LINE_REQUEST_FLAG_BIAS_PULL_UP);
+    }
+    if (rv < 0) {
+        fprintf(stderr, "Failed to request GPIO%d: %s\n", pin, strerror(errno));
+        return -1;
+    }
+
+    g->aux[g->aux_count] = line;
+    g->aux_pin[g->aux_count] = pin;
+    g->aux_count++;
+    return 0;
+}
+
+static void gpiod_aux_set(I2C_Config *config, int pin, int value) {
+    struct gpiod_line *line = aux_line(config->line_priv, pin);
+
+    if (line) {
+        gpiod_line_set_value(line, value);
+    }
+}
+
+static int gpiod_aux_wait(I2C_Config *config, int pin, int value, int timeout_us) {
+    struct gpiod_line *line = aux_line(config->line_priv, pin);
+    struct timespec start, now;
+    struct gpiod_line_event ev;
+
+    if (!line) {
+        return -1;
+    }
+
+    // The level decides; events only wake us up. They are drained while the
+    // line is not there yet, so a stale edge cannot end a later wait early.
+    // Every pass waits out what is left of one deadline, so a line that
+    // keeps toggling cannot stretch the wait.
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;) {
+        int level = gpiod_line_get_value(line);
+        if (level < 0) {
+            return -1;
+        }
+        if (level == value) {
+            return 1;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long left_us = timeout_us - ((now.tv_sec - start.tv_sec) * 1000000L +
+                                     (now.tv_nsec - start.tv_nsec) / 1000);
+        if (left_us <= 0) {
+            return 0;
+        }
+        struct timespec timeout = { left_us / 1000000, left_us % 1000000 * 1000 };
+        int rv = gpiod_line_event_wait(line, &timeout);
+        if (rv <= 0) {
+            return rv;
+        }
+        if (gpiod_line_event_read(line, &ev) < 0) {
+            return -1;
+        }
+    }
+}
+
+const I2C_LineOps i2c_gpiod_ops = {
+    .name = "gpiod",
+    .max_pin = -1,
+    .open = gpiod_open,
+    .close = gpiod_close,
+    .set_sda = gpiod_set_sda,
+    .set_scl = gpiod_set_scl,
+    .read_lines = gpiod_read_lines,
+    .set_sda_dir = gpiod_set_sda_dir,
+    .delay = gpiod_delay,
+    .read_edges = gpiod_read_edges,
+    .aux_open = gpiod_aux_open,
+    .aux_set = gpiod_aux_set,
+    .aux_wait = gpiod_aux_wait,
+    .set_sda_lines = gpiod_set_sda_lines,
+    .read_sda_lines = gpiod_read_sda_lines,
+};
@@ -0,0 +1,347 @@
+// i2c_log.c - Asynchronous logger for the bus hot paths
+//
+// Printing to a terminal or over SSH can block for milliseconds, which in
+// the middle of a byte desyncs the bus. i2c_log() only copies the format
+// pointer and the argument values into a fixed-size record of a
+// single-producer single-consumer ring; a low-priority writer thread
+// formats and prints the records. Every logging thread gets a ring of its
+// own, so bus threads never contend; the writer interleaves them by line.
+#define _GNU_SOURCE
+#include "i2c_log.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#define I2C_LOG_POLL_US 1000  // Writer sleep while the ring is empty
+#define I2C_LOG_NICE    19    // Writer thread niceness
+#define I2C_LOG_SPEC_MAX 32   // Longest conversion specification
+#define I2C_LOG_LINE_WAIT 20  // Polls the writer waits for the rest of a line
+
+// Argument a conversion takes
+enum {
+    ARG_NONE,    // "%%" or unsupported
+    ARG_INT,
+    ARG_LONG,
+    ARG_LLONG,
+    ARG_SIZE,
+    ARG_DOUBLE,
+    ARG_POINTER,  // %s and %p
+};
+
+typedef union {
+    long long i;
+    double d;
+    const void *p;
+} LogArg;
+
+typedef struct {
+    const char *fmt;
+    LogArg args[I2C_LOG_MAX_ARGS];
+} LogRecord;
+
+typedef struct {
+    LogRecord records[I2C_LOG_RING_SIZE];
+    atomic_size_t head;  // Next record to fill, advanced by the producer
+    atomic_size_t tail;  // Next record to print, advanced by the writer
+    const char *prefix;  // Printed at the start of each line, NULL for none
+    int line_open;       // Writer: last record printed did not end a line
+} LogRing;
+
+int i2c_log_level = I2C_LOG_INFO;
+
+static LogRing rings[I2C_LOG_MAX_THREADS];
+static atomic_int ring_count;        // Rings claimed so far
+static __thread LogRing *own_ring;   // Ring of the calling thread
+static atomic_ulong dropped;
+static atomic_int stopping;
+static atomic_int started;
+static pthread_t writer;
+
+// Parse the conversion specification after a '%' (flags, width, precision,
+// length, conversion; no '*'). Sets the argument it takes and returns the
+// character after it.
+static const char *parse_conversion(const char *p, int *type) {
+    int length = ARG_INT;
+
+    while (*p && strchr("-+ #0", *p)) p++;
+    while (*p >= '0' && *p <= '9') p++;
+    if (*p == '.') {
+        p++;
+        while (*p >= '0' && *p <= '9') p++;
+    }
+
+    if (*p == 'h') {
+        p += p[1] == 'h' ? 2 : 1;
+    } else if (*p == 'l') {
+        length = p[1] == 'l' ? ARG_LLONG : ARG_LONG;
+        p += p[1] == 'l' ? 2 : 1;
+    } else if (*p == 'z') {
+        length = ARG_SIZE;
+        p++;
+    }
+
+    switch (*p) {
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+        *type = length;
+        break;
+    case 'f': case 'e': case 'g': case 'E': case 'G':
+        *type = ARG_DOUBLE;
+        break;
+    case 's': case 'p':
+        *type = ARG_POINTER;
+        break;
+    default:
+        *type = ARG_NONE;
+        break;
+    }
+    return *p ? p + 1 : p;
+}
+
+// Format one record, one conversion at a time with its original type
+static void write_record(const LogRecord *rec, FILE *out) {
+    const char *p = rec->fmt;
+    int n = 0;
+
+    while (*p) {
+        const char *pct = strchr(p, '%');
+        if (!pct) {
+            fputs(p, out);
+            break;
+        }
+        fwrite(p, 1, pct - p, out);
+
+        int type;
+        const char *end = parse_conversion(pct + 1, &type);
+        size_t len = end - pct;
+        char spec[I2C_LOG_SPEC_MAX];
+
+        if (type == ARG_NONE || len >= sizeof(spec) || n >= I2C_LOG_MAX_ARGS) {
+            // "%%" prints one '%', anything else as written
+            if (len == 2 && pct[1] == '%') {
+                fputc('%', out);
+            } else {
+                fwrite(pct, 1, len, out);
+            }
+            p = end;
+            continue;
+        }
+        memcpy(spec, pct, len);
+        spec[len] = '\0';
+
+        const LogArg *arg = &rec->args[n++];
+        switch (type) {
+        case ARG_INT:
+            fprintf(out, spec, (int)arg->i);
+            break;
+        case ARG_LONG:
+            fprintf(out, spec, (long)arg->i);
+            break;
+        case ARG_LLONG:
+            fprintf(out, spec, arg->i);
+            break;
+        case ARG_SIZE:
+            fprintf(out, spec, (size_t)arg->i);
+            break;
+        case ARG_DOUBLE:
+            fprintf(out, spec, arg->d);
+            break;
+        case ARG_POINTER:
+            fprintf(out, spec, arg->p);
+            break;
+        }
+        p = end;
+    }
+}
+
+// Print the next record of a ring, with its prefix at the start of a line
+static void write_next(LogRing *ring) {
+    size_t t = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    const LogRecord *rec = &ring->records[t & (I2C_LOG_RING_SIZE - 1)];
+    size_t len = strlen(rec->fmt);
+
+    if (!ring->line_open && ring->prefix) {
+        fputs(ring->prefix, stdout);
+    }
+    write_record(rec, stdout);
+    ring->line_open = len > 0 && rec->fmt[len - 1] != '\n';
+    atomic_store_explicit(&ring->tail, t + 1, memory_order_release);
+}
+
+static int ring_pending(LogRing *ring) {
+    return atomic_load_explicit(&ring->tail, memory_order_relaxed) !=
+           atomic_load_explicit(&ring->head, memory_order_acquire);
+}
+
+static void *writer_thread(void *arg) {
+    sigset_t signals;
+    int current = 0;  // Ring being printed
+    int waited = 0;   // Polls spent waiting for the rest of its line
+    (void)arg;
+
+    // Bus threads always win the CPU over the writer
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), I2C_LOG_NICE);
+
+    // Leave SIGINT to the bus thread, whose blocking waits it interrupts
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    for (;;) {
+        int count = atomic_load(&ring_count);
+        LogRing *ring = &rings[current];
+
+        if (ring_pending(ring)) {
+            write_next(ring);
+            waited = 0;
+            continue;
+        }
+
+        // Stay with a ring until its line is complete, unless that takes
+        // long and other threads are waiting
+        int next = -1;
+        for (int i = 1; i <= count; i++) {
+            if (ring_pending(&rings[(current + i) % count])) {
+                next = (current + i) % count;
+                break;
+            }
+        }
+        if (next >= 0 && (!ring->line_open || waited >= I2C_LOG_LINE_WAIT)) {
+            if (ring->line_open) {
+                fputc('\n', stdout);
+                ring->line_open = 0;
+            }
+            current = next;
+            waited = 0;
+            continue;
+        }
+
+        fflush(stdout);
+        if (next < 0 && atomic_load(&stopping)) {
+            break;
+        }
+        usleep(I2C_LOG_POLL_US);
+        waited++;
+    }
+    return NULL;
+}
+
+int i2c_log_start(int level) {
+    pthread_attr_t attr;
+    struct sched_param param = {0};
+
+    i2c_log_level = level;
+
+    // Do not inherit a real-time policy from the bus thread
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    pthread_attr_setschedparam(&attr, &param);
+
+    atomic_store(&stopping, 0);
+    int result = pthread_create(&writer, &attr, writer_thread, NULL);
+    pthread_attr_destroy(&attr);
+    if (result != 0) {
+        fprintf(stderr, "Failed to start log writer, logging synchronously\n");
+        return -1;
+    }
+
+    fflush(stdout);
+    atomic_store(&started, 1);
+    return 0;
+}
+
+int i2c_log_thread(const char *prefix) {
+    if (!own_ring) {
+        int n = atomic_fetch_add(&ring_count, 1);
+        if (n >= I2C_LOG_MAX_THREADS) {
+            atomic_fetch_sub(&ring_count, 1);
+            return -1;
+        }
+        own_ring = &rings[n];
+    }
+    own_ring->prefix = prefix;
+    return 0;
+}
+
+void i2c_log_stop(void) {
+    if (!atomic_load(&started)) {
+        return;
+    }
+
+    atomic_store(&stopping, 1);
+    pthread_join(writer, NULL);
+    atomic_store(&started, 0);
+
+    if (atomic_load(&dropped)) {
+        fprintf(stderr, "Log: %lu messages dropped (ring full)\n", atomic_load(&dropped));
+    }
+}
+
+void i2c_log(int level, const char *fmt, ...) {
+    va_list ap;
+
+    if (level > i2c_log_level) {
+        return;
+    }
+
+    va_start(ap, fmt);
+    if (!atomic_load_explicit(&started, memory_order_relaxed) || (!own_ring && i2c_log_thread(NULL) < 0)) {
+        vprintf(fmt, ap);
+        va_end(ap);
+        return;
+    }
+
+    LogRing *ring = own_ring;
+    size_t h = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (h - atomic_load_explicit(&ring->tail, memory_order_acquire) == I2C_LOG_RING_SIZE) {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        va_end(ap);
+        return;
+    }
+
+    // Copy the arguments by the type their conversion takes
+    LogRecord *rec = &ring->records[h & (I2C_LOG_RING_SIZE - 1)];
+    const char *p = fmt;
+    int n = 0;
+
+    rec->fmt = fmt;
+    while (n < I2C_LOG_MAX_ARGS && (p = strchr(p, '%')) != NULL) {
+        int type;
+        p = parse_conversion(p + 1, &type);
+
+        switch (type) {
+        case ARG_INT:
+            rec->args[n++].i = va_arg(ap, int);
+            break;
+        case ARG_LONG:
+            rec->args[n++].i = va_arg(ap, long);
+            break;
+        case ARG_LLONG:
+            rec->args[n++].i = va_arg(ap, long long);
+            break;
+        case ARG_SIZE:
+            rec->args[n++].i = (long long)va_arg(ap, size_t);
+            break;
+        case ARG_DOUBLE:
+            rec->args[n++].d = va_arg(ap, double);
+            break;
+        case ARG_POINTER:
+            rec->args[n++].p = va_arg(ap, const void *);
+            break;
+        }
+    }
+    va_end(ap);
+
+    atomic_store_explicit(&ring->head, h + 1, memory_order_release);
+}
+
+unsigned long i2c_log_dropped(void) {
+    return atomic_load(&dropped);
+}
@@ -0,0 +1,40 @@
+// i2c_log.h - Asynchronous logger for the bus hot paths
+#ifndef I2C_LOG_H
+#define I2C_LOG_H
+
+// Verbosity levels: a message is logged if its level is at most the
+// level chosen at run time
+#define I2C_LOG_ERROR 0  // Failures only
+#define I2C_LOG_INFO  1  // Per-transaction and per-cycle progress (default)
+#define I2C_LOG_DEBUG 2  // Extra diagnostics
+
+#define I2C_LOG_RING_SIZE 4096  // Records in the ring, a power of two
+#define I2C_LOG_MAX_ARGS  8     // Conversions per message
+#define I2C_LOG_MAX_THREADS 8   // Threads with a ring of their own
+
+extern int i2c_log_level;
+
+// Start the writer thread. Until then, and after i2c_log_stop(), messages
+// are printed synchronously.
+int i2c_log_start(int level);
+
+// Write out everything queued, stop the writer thread and report drops
+void i2c_log_stop(void);
+
+// Give the calling thread its own ring, with prefix (may be NULL) printed
+// at the start of each of its lines. Threads that log without calling it
+// get one on their first message. Returns -1 once all rings are taken;
+// such threads print synchronously.
+int i2c_log_thread(const char *prefix);
+
+// Queue a message for stdout in the calling thread's ring. Arguments are
+// copied as values, so %s strings must outlive the call (string literals).
+// Never blocks: with the ring full the message is counted as dropped.
+// Lines of different threads are not mixed, unless one leaves a line
+// unfinished for a while.
+void i2c_log(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Messages dropped because the ring was full
+unsigned long i2c_log_dropped(void);
+
+#endif // I2C_LOG_H
@@ -0,0 +1,183 @@
+// i2c_mmio.c - Memory-mapped GPIO register line backend for soft I2C
+#include "soft_i2c.h"
+#include "gpio_mmio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MMIO_AUX_POLL_US 50  // Level register poll interval while waiting on a line
+
+typedef struct {
+    GPIO_MMIO gpio;
+    uint32_t sda_mask;  // All SDA pins of a wide bus
+    uint32_t scl_mask;
+    int sda_pins[I2C_WIDE_MAX];  // Wide bus: pin of SDA line n
+    int width;
+    uint32_t aux_out;  // Auxiliary outputs, released on close
+} MmioLines;
+
+// Map the GPIO register block and set the pins up as emulated open-drain
+static int mmio_open(I2C_Config *config, const char *consumer) {
+    const char *path = config->device ? config->device : GPIO_MMIO_DEVICE;
+    int width = config->width > 1 ? config->width : 1;
+    (void)consumer;
+
+    for (int n = 0; n < width; n++) {
+        int pin = config->width > 1 ? config->sda_pins[n] : config->sda_pin;
+        if (pin < 0 || pin > GPIO_MMIO_MAX_PIN) {
+            fprintf(stderr, "GPIO register backend only supports GPIO0-%d\n", GPIO_MMIO_MAX_PIN);
+            return -1;
+        }
+    }
+    if (config->scl_pin > GPIO_MMIO_MAX_PIN) {
+        fprintf(stderr, "GPIO register backend only supports GPIO0-%d\n", GPIO_MMIO_MAX_PIN);
+        return -1;
+    }
+
+    MmioLines *m = calloc(1, sizeof(*m));
+    if (!m) {
+        return -1;
+    }
+    // Only a device given explicitly may be a fake register block
+    if (gpio_mmio_open(&m->gpio, path, config->device != NULL) < 0) {
+        free(m);
+        return -1;
+    }
+
+    m->width = width;
+    for (int n = 0; n < width; n++) {
+        m->sda_pins[n] = config->width > 1 ? config->sda_pins[n] : config->sda_pin;
+        m->sda_mask |= 1u << m->sda_pins[n];
+    }
+    m->scl_mask = 1u << config->scl_pin;
+    gpio_mmio_open_drain_init(&m->gpio, m->sda_mask | m->scl_mask);
+
+    printf("GPIO register backend: %s%s (%s)\n", path, m->gpio.fake ? " [fake]" : "",
+           m->gpio.bcm2711 ? "BCM2711" : "BCM283x");
+
+    config->line_priv = m;
+    return 0;
+}
+
+static void mmio_close(I2C_Config *config) {
+    MmioLines *m = config->line_priv;
+
+    // Leave all lines released
+    uint32_t pins = m->sda_mask | m->scl_mask | m->aux_out;
+    gpio_mmio_open_drain_write(&m->gpio, pins, pins);
+    gpio_mmio_close(&m->gpio);
+    free(m);
+    config->line_priv = NULL;
+}
+
+static void mmio_set_sda(I2C_Config *config, int value) {
+    MmioLines *m = config->line_priv;
+    gpio_mmio_open_drain_write(&m->gpio, m->sda_mask, value ? m->sda_mask : 0);
+}
+
+static void mmio_set_scl(I2C_Config *config, int value) {
+    MmioLines *m = config->line_priv;
+    gpio_mmio_open_drain_write(&m->gpio, m->scl_mask, value ? m->scl_mask : 0);
+}
+
+// One GPLEV0 load samples both lines
+static int mmio_read_lines(I2C_Config *config, int *sda, int *scl) {
+    MmioLines *m = config->line_priv;
+    uint32_t levels = gpio_mmio_read_levels(&m->gpio);
+
+    *sda = (levels & m->sda_mask) == m->sda_mask;
+    *scl = (levels & m->scl_mask) != 0;
+    return 0;
+}
+
+// Wide bus: all SDA pins are in bank 0, so the open-drain write switches
+// them with one GPFSEL write per register they share, and one GPLEV0 load
+// samples them
+static void mmio_set_sda_lines(I2C_Config *config, uint32_t levels) {
+    MmioLines *m = config->line_priv;
+    uint32_t high = 0;
+
+    for (int n = 0; n < m->width; n++) {
+        if (levels & (1u << n)) {
+            high |= 1u << m->sda_pins[n];
+        }
+    }
+    gpio_mmio_open_drain_write(&m->gpio, m->sda_mask, high);
+}
+
+static int mmio_read_sda_lines(I2C_Config *config, uint32_t *levels, int *scl) {
+    MmioLines *m = config->line_priv;
+    uint32_t pins = gpio_mmio_read_levels(&m->gpio);
+
+    *levels = 0;
+    for (int n = 0; n < m->width; n++) {
+        *levels |= ((pins >> m->sda_pins[n]) & 1) << n;
+    }
+    *scl = (pins & m->scl_mask) != 0;
+    return 0;
+}
+
+static void mmio_delay(I2C_Config *config, int us) {
+    i2c_delay_us(&config->timing, us);
+}
+
+static int mmio_aux_open(I2C_Config *config, int pin, int dir) {
+    MmioLines *m = config->line_priv;
+    uint32_t mask = 1u << pin;
+
+    if (pin > GPIO_MMIO_MAX_PIN) {
+        fprintf(stderr, "GPIO register backend only supports GPIO0-%d\n", GPIO_MMIO_MAX_PIN);
+        return -1;
+    }
+    if (dir == I2C_DIR_OUT) {
+        gpio_mmio_open_drain_init(&m->gpio, mask);
+        m->aux_out |= mask;
+    } else {
+        gpio_mmio_set_pull_up(&m->gpio, mask);
+        gpio_mmio_set_function(&m->gpio, mask, GPIO_FSEL_INPUT);
+    }
+    return 0;
+}
+
+static void mmio_aux_set(I2C_Config *config, int pin, int value) {
+    MmioLines *m = config->line_priv;
+    gpio_mmio_open_drain_write(&m->gpio, 1u << pin, value ? 1u << pin : 0);
+}
+
+// The register block has no interrupts, so waiting polls the level register
+static int mmio_aux_wait(I2C_Config *config, int pin, int value, int timeout_us) {
+    MmioLines *m = config->line_priv;
+    struct timespec start, now;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;) {
+        int level = (gpio_mmio_read_levels(&m->gpio) >> pin) & 1;
+        if (level == value) {
+            return 1;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long waited_us = (now.tv_sec - start.tv_sec) * 1000000L + (now.tv_nsec - start.tv_nsec) / 1000;
+        if (waited_us >= timeout_us) {
+            return 0;
+        }
+        i2c_delay_us(&config->timing, MMIO_AUX_POLL_US);
+    }
+}
+
+const I2C_LineOps i2c_mmio_ops = {
+    .name = "gpiomem",
+    .max_pin = GPIO_MMIO_MAX_PIN,
+    .open = mmio_open,
+    .close = mmio_close,
+    .set_sda = mmio_set_sda,
+    .set_scl = mmio_set_scl,
+    .read_lines = mmio_read_lines,
+    .set_sda_dir = NULL,
+    .delay = mmio_delay,
+    .aux_open = mmio_aux_open,
+    .aux_set = mmio_aux_set,
+    .aux_wait = mmio_aux_wait,
+    .set_sda_lines = mmio_set_sda_lines,
+    .read_sda_lines = mmio_read_sda_lines,
+};
@@ -0,0 +1,121 @@
+// i2c_rate.c - Closed-loop bit rate control for the soft I2C master
+#include "i2c_rate.h"
+#include "i2c_log.h"
+#include <stdio.h>
+#include <string.h>
+
+// Each data bit takes three bit delays (setup, SCL high, SCL low)
+#define I2C_RATE_DELAYS_PER_BIT 3
+
+static double kbit_per_s(int bit_delay_us) {
+    return 1000.0 / (I2C_RATE_DELAYS_PER_BIT * bit_delay_us);
+}
+
+void i2c_rate_init(I2C_RateController *rate, I2C_Config *config, int min_delay_us, int max_delay_us) {
+    memset(rate, 0, sizeof(*rate));
+    rate->min_delay_us = min_delay_us > 0 ? min_delay_us : 1;
+    rate->max_delay_us = max_delay_us;
+    rate->stretch_timeouts = config->stretch_timeouts;
+    
+    printf("Adaptive bit rate: %d-%d us/bit delay, starting at %d us\n",
+           rate->min_delay_us, rate->max_delay_us, config->bit_delay);
+}
+
+static void set_delay(I2C_Config *config, int delay_us) {
+    config->bit_delay = delay_us;
+}
+
+static void end_window(I2C_RateController *rate, I2C_Config *config) {
+    int errors = rate->nacks + rate->timeouts + rate->bad_data;
+    int old = config->bit_delay;
+    
+    if (errors > 0 && errors < I2C_RATE_BACKOFF_ERRORS) {
+        // A stray error: hold the rate, but start counting clean windows anew
+        rate->clean_windows = 0;
+        i2c_log(I2C_LOG_INFO, "Rate: %d/%d errors, holding bit_delay at %d us\n", errors, rate->transactions, old);
+        return;
+    }
+    
+    if (errors > 0) {
+        // Back off, and never come back down to a delay that failed
+        int delay = old * I2C_RATE_BACKOFF;
+        if (delay > rate->max_delay_us) {
+            delay = rate->max_delay_us;
+        }
+        if (rate->floor_us == 0 || old > rate->floor_us) {
+            rate->floor_us = old;
+        }
+        rate->floor_age = 0;
+        rate->clean_windows = 0;
+        rate->settled = 0;
+        rate->backoffs++;
+        set_delay(config, delay);
+        i2c_log(I2C_LOG_INFO, "Rate: %d/%d errors (%d NACK, %d timeout, %d bad data), bit_delay %d -> %d us\n",
+                errors, rate->transactions, rate->nacks, rate->timeouts, rate->bad_data, old, delay);
+        return;
+    }
+    
+    rate->clean_windows++;
+    if (rate->floor_us && ++rate->floor_age >= I2C_RATE_FLOOR_WINDOWS) {
+        // Conditions may have changed: allow the failed delay again
+        i2c_log(I2C_LOG_INFO, "Rate: retrying below %d us\n", rate->floor_us);
+        rate->floor_us = 0;
+        rate->settled = 0;
+    }
+    if (rate->clean_windows < I2C_RATE_CLEAN_WINDOWS) {
+        return;
+    }
+    rate->clean_windows = 0;
+    
+    int delay = old * I2C_RATE_SPEEDUP_NUM / I2C_RATE_SPEEDUP_DEN;
+    if (delay < rate->min_delay_us) {
+        delay = rate->min_delay_us;
+    }
+    if (rate->floor_us && delay <= rate->floor_us) {
+        delay = rate->floor_us + 1;
+    }
+    
+    if (delay >= old) {
+        // Nothing faster left to try: this is the operating point
+        if (!rate->settled) {
+            rate->settled = 1;
+            i2c_log(I2C_LOG_INFO, "Rate: settled at %d us bit delay (~%.2f kbit/s)\n", old, kbit_per_s(old));
+        }
+        return;
+    }
+    
+    rate->speedups++;
+    set_delay(config, delay);
+    i2c_log(I2C_LOG_INFO, "Rate: clean, bit_delay %d -> %d us\n", old, delay);
+}
+
+void i2c_rate_record(I2C_RateController *rate, I2C_Config *config, int outcome) {
+    if (outcome == I2C_RATE_NACK && config->stretch_timeouts != rate->stretch_timeouts) {
+        rate->timeouts++;
+    } else if (outcome == I2C_RATE_NACK) {
+        rate->nacks++;
+    } else if (outcome == I2C_RATE_BAD_DATA) {
+        rate->bad_data++;
+    }
+    rate->stretch_timeouts = config->stretch_timeouts;
+    
+    if (++rate->transactions < I2C_RATE_WINDOW) {
+        return;
+    }
+    
+    end_window(rate, config);
+    rate->transactions = 0;
+    rate->nacks = 0;
+    rate->timeouts = 0;
+    rate->bad_data = 0;
+}
+
+void i2c_rate_report(const I2C_RateController *rate, const I2C_Config *config) {
+    printf("Adaptive bit rate: %d us bit delay (~%.2f kbit/s)%s, %lu speedups, %lu backoffs",
+           config->bit_delay, kbit_per_s(config->bit_delay), rate->settled ? " settled" : "",
+           rate->speedups, rate->backoffs);
+    if (rate->floor_us) {
+        printf(", fails at %d us", rate->floor_us);
+    }
+    printf("\n");
+}
@@ -0,0 +1,56 @@
+// i2c_rate.h - Closed-loop bit rate control for the soft I2C master
+#ifndef I2C_RATE_H
+#define I2C_RATE_H
+
+#include "soft_i2c.h"
+
+#define I2C_RATE_WINDOW         25      // Transactions per evaluation window
+#define I2C_RATE_CLEAN_WINDOWS  2       // Clean windows in a row before speeding up
+#define I2C_RATE_BACKOFF_ERRORS 2       // Errors in a window that make it back off
+#define I2C_RATE_SPEEDUP_NUM    3       // Speed up: bit_delay * 3/4
+#define I2C_RATE_SPEEDUP_DEN    4
+#define I2C_RATE_BACKOFF        2       // Back off: bit_delay * 2
+#define I2C_RATE_FLOOR_WINDOWS  100     // Clean windows before a failed delay is tried again
+
+// Outcome of one transaction, as judged by the caller
+#define I2C_RATE_OK             0
+#define I2C_RATE_NACK           1       // Transaction failed (no ACK, bus error)
+#define I2C_RATE_BAD_DATA       2       // Transaction completed but the data is implausible
+
+// Adapts config->bit_delay to the error rate: after I2C_RATE_CLEAN_WINDOWS
+// error-free windows the delay shrinks by a quarter, I2C_RATE_BACKOFF_ERRORS
+// errors in a window double it, and a single error holds it. A delay that
+// made it back off becomes a floor the controller does not go down to
+// again (hysteresis), until it has stayed clean for I2C_RATE_FLOOR_WINDOWS
+// windows. Failures that coincide with a clock
+// stretch timeout are counted as timeouts.
+typedef struct {
+    int min_delay_us;
+    int max_delay_us;
+    int floor_us;                // Fastest delay known to fail, 0 = none
+    int settled;                 // Operating point reported
+    
+    // Current window
+    int transactions;
+    int nacks;
+    int timeouts;
+    int bad_data;
+    int clean_windows;           // Error-free windows in a row
+    int floor_age;               // Clean windows since the floor was set
+    unsigned long stretch_timeouts;  // config->stretch_timeouts at the last record
+    
+    // Totals
+    unsigned long speedups;
+    unsigned long backoffs;
+} I2C_RateController;
+
+void i2c_rate_init(I2C_RateController *rate, I2C_Config *config, int min_delay_us, int max_delay_us);
+
+// Record the outcome of one transaction and adjust config->bit_delay at
+// the end of each window
+void i2c_rate_record(I2C_RateController *rate, I2C_Config *config, int outcome);
+
+// Print the current operating point
+void i2c_rate_report(const I2C_RateController *rate, const I2C_Config *config);
+
+#endif // I2C_RATE_H
@@ -0,0 +1,156 @@
+// i2c_rt.c - Real-time execution profile for the bit-banging processes
+//
+// A single preemption in the middle of a byte desyncs a bit-banged bus.
+// The profile shrinks the worst-case scheduling latency: a real-time
+// scheduling class so ordinary tasks cannot preempt us, locked memory so
+// no page fault stalls a bit, a dedicated (ideally isolcpus) core and the
+// smallest timer slack so sleeps wake up on time.
+#define _GNU_SOURCE
+#include "i2c_rt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+
+#define I2C_RT_ISOLATED_CPUS    "/sys/devices/system/cpu/isolated"
+
+void i2c_rt_defaults(I2C_RtProfile *rt) {
+    memset(rt, 0, sizeof(*rt));
+    rt->cpu = -1;
+}
+
+// Touch the stack we will need so its pages are resident before the bus
+// starts; with MCL_FUTURE they then stay locked
+static void __attribute__((noinline)) prefault_stack(void) {
+    volatile unsigned char stack[I2C_RT_STACK_PREFAULT];
+    memset((void *)stack, 0, sizeof(stack));
+}
+
+// Parse /sys/devices/system/cpu/isolated ("2-3,5") into a CPU set
+static int read_isolated_cpus(cpu_set_t *set) {
+    char buf[256];
+    FILE *f = fopen(I2C_RT_ISOLATED_CPUS, "r");
+    int count = 0;
+    
+    CPU_ZERO(set);
+    if (!f) {
+        return 0;
+    }
+    if (fgets(buf, sizeof(buf), f)) {
+        char *p = buf;
+        while (*p && *p != '\n') {
+            char *end;
+            long first = strtol(p, &end, 10);
+            long last = first;
+            if (end == p) {
+                break;
+            }
+            if (*end == '-') {
+                p = end + 1;
+                last = strtol(p, &end, 10);
+            }
+            for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+                CPU_SET(cpu, set);
+                count++;
+            }
+            p = (*end == ',') ? end + 1 : end;
+        }
+    }
+    fclose(f);
+    return count;
+}
+
+int i2c_rt_thread_cpu(const I2C_RtProfile *rt, int n) {
+    cpu_set_t isolated;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    
+    if (rt->cpu >= 0) {
+        return (rt->cpu + n) % (online > 0 ? online : 1);
+    }
+    
+    int n_isolated = read_isolated_cpus(&isolated);
+    if (n_isolated <= 0) {
+        return -1;
+    }
+    n %= n_isolated;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &isolated) && n-- == 0) {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+int i2c_rt_apply(const I2C_RtProfile *rt) {
+    int failed = 0;
+    int denied = 0;  // A failure was for lack of privileges
+    
+    if (!rt->enabled) {
+        return 0;
+    }
+    
+    printf("Real-time profile:\n");
+    
+    // CPU affinity first, so the other steps run on the chosen core
+    cpu_set_t isolated;
+    int n_isolated = read_isolated_cpus(&isolated);
+    int cpu = rt->cpu;
+    if (cpu < 0 && n_isolated > 0) {
+        for (cpu = 0; !CPU_ISSET(cpu, &isolated); cpu++) {
+        }
+    }
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+            printf("  CPU affinity:      FAILED, CPU %d: %s\n", cpu, strerror(errno));
+            failed++;
+            denied |= errno == EPERM;
+        } else {
+            printf("  CPU affinity:      CPU %d (%s)\n", cpu,
+                   CPU_ISSET(cpu, &isolated) ? "isolated" : "not isolated, shared with other tasks");
+        }
+    } else {
+        printf("  CPU affinity:      none (no isolcpus core, use -c to choose one)\n");
+    }
+    
+    // Lock current and future pages, then fault in the stack
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        printf("  Memory lock:       FAILED: %s\n", strerror(errno));
+        failed++;
+        denied |= errno == EPERM;
+    } else {
+        prefault_stack();
+        printf("  Memory lock:       locked, %d KB stack prefaulted\n", I2C_RT_STACK_PREFAULT / 1024);
+    }
+    
+    if (prctl(PR_SET_TIMERSLACK, I2C_RT_TIMER_SLACK_NS) < 0) {
+        printf("  Timer slack:       FAILED: %s\n", strerror(errno));
+        failed++;
+        denied |= errno == EPERM;
+    } else {
+        printf("  Timer slack:       %d ns\n", I2C_RT_TIMER_SLACK_NS);
+    }
+    
+    struct sched_param param = { .sched_priority = rt->priority ? rt->priority : I2C_RT_DEFAULT_PRIORITY };
+    if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+        printf("  Scheduling:        FAILED, SCHED_FIFO %d: %s\n", param.sched_priority, strerror(errno));
+        failed++;
+        denied |= errno == EPERM;
+    } else {
+        printf("  Scheduling:        SCHED_FIFO priority %d\n", param.sched_priority);
+    }
+    
+    if (failed) {
+        fprintf(stderr, "%s: %d real-time guarantee(s) not obtained%s\n",
+                rt->required ? "Error" : "Warning", failed,
+                denied ? " (needs root or CAP_SYS_NICE/CAP_IPC_LOCK)" : "");
+        return rt->required ? -1 : 0;
+    }
+    return 0;
+}
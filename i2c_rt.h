@@ -0,0 +1,29 @@
+// i2c_rt.h - Real-time execution profile for the bit-banging processes
+#ifndef I2C_RT_H
+#define I2C_RT_H
+
+#define I2C_RT_DEFAULT_PRIORITY 80          // SCHED_FIFO priority used by -r/-R
+#define I2C_RT_STACK_PREFAULT   (256 * 1024) // Stack touched after mlockall
+#define I2C_RT_TIMER_SLACK_NS   1           // Smallest timer slack the kernel accepts
+
+typedef struct {
+    int enabled;
+    int required;  // Fail instead of warn when a guarantee cannot be obtained
+    int priority;  // SCHED_FIFO priority, 0 selects I2C_RT_DEFAULT_PRIORITY
+    int cpu;       // CPU to pin to, -1 = first isolated CPU if any
+} I2C_RtProfile;
+
+// Initialize a profile to "disabled, no CPU chosen"
+void i2c_rt_defaults(I2C_RtProfile *rt);
+
+// CPU for the n-th of several bus threads: the chosen CPU + n (wrapping
+// at the CPUs online), else the n-th isolated CPU (wrapping), else -1
+int i2c_rt_thread_cpu(const I2C_RtProfile *rt, int n);
+
+// Apply the profile to the calling thread: SCHED_FIFO, mlockall with a
+// prefaulted stack (for the whole process), CPU affinity and minimal timer
+// slack. Prints which of them were obtained. Returns -1 if any failed and
+// the profile is required.
+int i2c_rt_apply(const I2C_RtProfile *rt);
+
+#endif // I2C_RT_H
@@ -0,0 +1,467 @@
+// i2c_sim.c - Simulated open-drain wire for soft I2C
+//
+// The wire is a small block of shared memory (a file, by default in
+// /dev/shm) that any number of endpoints attach to, either threads of one
+// process or separate master and slave processes. Each endpoint publishes
+// the lines it pulls low; a line reads high only when no endpoint pulls it
+// low, like a real bus with pull-ups. Lines are addressed by GPIO number,
+// so the same pin constants work as on the Pi.
+//
+// Writes run in lockstep: before changing a line again, a writer waits
+// until every other endpoint on its bus has sampled its previous change,
+// so no edge is lost however short the bit delay or however the scheduler
+// interleaves the endpoints. The writer itself never blocks right after a
+// change, so it can react to the bus as fast as on real hardware.
+// Endpoints that share neither SDA nor SCL are separate buses on the same
+// wire and do not wait on each other. A wide bus is one endpoint with
+// several SDA pins, written and sampled together.
+//
+// Every change is also published, with a timestamp and the resulting line
+// levels, in a log ring on the wire. Endpoints opened for edge events read
+// their edges from that log and only count a change as sampled once they
+// come back for more, i.e. after the previous batch has been decoded.
+#include "soft_i2c.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define I2C_SIM_DEFAULT_WIRE    "/dev/shm/i2c_sim_wire"
+#define I2C_SIM_MAX_ENDPOINTS   16
+#define I2C_SIM_MAX_PIN         31
+#define I2C_SIM_SYNC_TIMEOUT_US 100000  // Stop waiting for a peer that does not sample
+#define I2C_SIM_LOG_SIZE        1024    // Line changes kept for edge readers
+#define I2C_SIM_EVENT_SPIN_US   1000    // Edge readers yield this long before sleeping
+#define I2C_SIM_EVENT_POLL_US   50      // Edge reader sleep between log checks
+#define I2C_SIM_AUX_POLL_US     50      // Sleep between checks while waiting on an auxiliary line
+
+typedef struct {
+    _Atomic int32_t pid;    // Owning process, 0 = free slot
+    _Atomic uint32_t low;   // Lines this endpoint pulls low, one bit per pin
+    _Atomic uint32_t seen;  // Last wire sequence this endpoint sampled
+    _Atomic uint32_t bus;   // Its SDA and SCL pins, one bit per pin
+} SimEndpoint;
+
+typedef struct {
+    _Atomic uint32_t stamp;  // Sequence of the change once the entry is complete
+    uint32_t levels;         // Wire levels after the change
+    uint64_t ts_ns;          // CLOCK_MONOTONIC time of the change
+} SimLogEntry;
+
+typedef struct {
+    _Atomic uint32_t seq;   // Bumped on every line change
+    SimEndpoint ep[I2C_SIM_MAX_ENDPOINTS];
+    SimLogEntry log[I2C_SIM_LOG_SIZE];  // Indexed by seq
+} SimWire;
+
+typedef struct {
+    SimWire *wire;
+    int fd;
+    int slot;
+    uint32_t last_seq;  // Sequence of our last change
+    uint32_t sda_mask;  // All SDA pins of a wide bus
+    uint32_t scl_mask;
+    int sda_pins[I2C_WIDE_MAX];  // Wide bus: pin of SDA line n
+    int width;
+    // Edge reader state
+    int events;         // Sampling is acknowledged by sim_read_edges only
+    uint32_t ev_seq;    // Last log entry consumed
+    int sda_level;      // Levels after the last reported edge
+    int scl_level;
+} SimLines;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int endpoint_alive(SimEndpoint *ep) {
+    int32_t pid = atomic_load(&ep->pid);
+    return pid != 0 && !(kill(pid, 0) < 0 && errno == ESRCH);
+}
+
+// Wired-AND of all endpoints
+static uint32_t wire_levels(SimWire *wire) {
+    uint32_t low = 0;
+    for (int i = 0; i < I2C_SIM_MAX_ENDPOINTS; i++) {
+        if (atomic_load(&wire->ep[i].pid) != 0) {
+            low |= atomic_load(&wire->ep[i].low);
+        }
+    }
+    return ~low;
+}
+
+// Bump the wire sequence after a change and log the resulting levels
+static uint32_t wire_publish(SimWire *wire) {
+    struct timespec ts;
+    uint32_t seq = atomic_fetch_add(&wire->seq, 1) + 1;
+    SimLogEntry *entry = &wire->log[seq % I2C_SIM_LOG_SIZE];
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    entry->levels = wire_levels(wire);
+    entry->ts_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    atomic_store(&entry->stamp, seq);
+    return seq;
+}
+
+// Free the slot of an endpoint whose process died without detaching
+static void endpoint_reap(SimWire *wire, SimEndpoint *ep) {
+    int32_t pid = atomic_load(&ep->pid);
+    if (pid != 0 && !endpoint_alive(ep)) {
+        atomic_store(&ep->low, 0);
+        if (atomic_compare_exchange_strong(&ep->pid, &pid, 0)) {
+            wire_publish(wire);
+        }
+    }
+}
+
+// Wait until every other endpoint on our bus has sampled the wire at or
+// after seq
+static void wire_sync(SimLines *s, uint32_t seq) {
+    SimWire *wire = s->wire;
+    uint64_t start = 0;
+
+    for (int i = 0; i < I2C_SIM_MAX_ENDPOINTS; i++) {
+        SimEndpoint *ep = &wire->ep[i];
+        if (i == s->slot || !(atomic_load(&ep->bus) & (s->sda_mask | s->scl_mask))) {
+            continue;
+        }
+        while (atomic_load(&ep->pid) != 0 && (int32_t)(atomic_load(&ep->seen) - seq) < 0) {
+            // Waiting counts as sampling, so two writers never wait on each
+            // other (edge readers still acknowledge through their log)
+            if (!s->events) {
+                atomic_store(&wire->ep[s->slot].seen, atomic_load(&wire->seq));
+            }
+            sched_yield();
+
+            if (start == 0) {
+                start = now_us();
+            } else if (now_us() - start > I2C_SIM_SYNC_TIMEOUT_US) {
+                endpoint_reap(wire, ep);
+                break;
+            }
+        }
+    }
+}
+
+// Release the pins of mask that are set in high, pull the others low.
+// Only the bits of mask are touched, so another thread driving auxiliary
+// pins of the same endpoint (sim_aux_set) is never overwritten.
+static void wire_drive(I2C_Config *config, uint32_t mask, uint32_t high) {
+    SimLines *s = config->line_priv;
+    SimEndpoint *self = &s->wire->ep[s->slot];
+    uint32_t low = atomic_load(&self->low);
+    uint32_t updated;
+
+    if ((low & mask) == (mask & ~high)) {
+        return;
+    }
+    wire_sync(s, s->last_seq);
+    low = atomic_load(&self->low);
+    do {
+        updated = (low & ~mask) | (mask & ~high);
+    } while (!atomic_compare_exchange_weak(&self->low, &low, updated));
+    s->last_seq = wire_publish(s->wire);
+    if (!s->events) {
+        atomic_store(&self->seen, s->last_seq);
+    }
+}
+
+static int sim_open(I2C_Config *config, const char *consumer) {
+    const char *path = config->device ? config->device : I2C_SIM_DEFAULT_WIRE;
+    struct stat st;
+    (void)consumer;
+
+    int width = config->width > 1 ? config->width : 1;
+    for (int n = 0; n < width; n++) {
+        int pin = config->width > 1 ? config->sda_pins[n] : config->sda_pin;
+        if (pin < 0 || pin > I2C_SIM_MAX_PIN) {
+            fprintf(stderr, "Simulated wire only supports pins 0-%d\n", I2C_SIM_MAX_PIN);
+            return -1;
+        }
+    }
+    if (config->scl_pin > I2C_SIM_MAX_PIN) {
+        fprintf(stderr, "Simulated wire only supports pins 0-%d\n", I2C_SIM_MAX_PIN);
+        return -1;
+    }
+
+    SimLines *s = calloc(1, sizeof(*s));
+    if (!s) {
+        return -1;
+    }
+
+    s->fd = open(path, O_RDWR | O_CREAT, 0666);
+    if (s->fd < 0) {
+        fprintf(stderr, "Failed to open sim wire %s: %s\n", path, strerror(errno));
+        free(s);
+        return -1;
+    }
+    // A freshly created (zero-filled) file is an idle wire
+    if (fstat(s->fd, &st) < 0 ||
+        (st.st_size < (off_t)sizeof(SimWire) && ftruncate(s->fd, sizeof(SimWire)) < 0)) {
+        fprintf(stderr, "Failed to size sim wire %s: %s\n", path, strerror(errno));
+        close(s->fd);
+        free(s);
+        return -1;
+    }
+
+    s->wire = mmap(NULL, sizeof(SimWire), PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+    if (s->wire == MAP_FAILED) {
+        fprintf(stderr, "Failed to map sim wire %s: %s\n", path, strerror(errno));
+        close(s->fd);
+        free(s);
+        return -1;
+    }
+
+    s->width = width;
+    for (int n = 0; n < width; n++) {
+        s->sda_pins[n] = config->width > 1 ? config->sda_pins[n] : config->sda_pin;
+        s->sda_mask |= 1u << s->sda_pins[n];
+    }
+    s->scl_mask = 1u << config->scl_pin;
+
+    // Claim a free endpoint slot, reaping ones left behind by dead processes
+    s->slot = -1;
+    for (int i = 0; i < I2C_SIM_MAX_ENDPOINTS && s->slot < 0; i++) {
+        int32_t expected = 0;
+        endpoint_reap(s->wire, &s->wire->ep[i]);
+        if (atomic_compare_exchange_strong(&s->wire->ep[i].pid, &expected, (int32_t)getpid())) {
+            atomic_store(&s->wire->ep[i].low, 0);
+            atomic_store(&s->wire->ep[i].bus, s->sda_mask | s->scl_mask);
+            s->last_seq = atomic_load(&s->wire->seq);
+            atomic_store(&s->wire->ep[i].seen, s->last_seq);
+            s->slot = i;
+        }
+    }
+    s->ev_seq = s->last_seq;
+    if (s->slot < 0) {
+        fprintf(stderr, "Sim wire %s has no free endpoint slot\n", path);
+        munmap(s->wire, sizeof(SimWire));
+        close(s->fd);
+        free(s);
+        return -1;
+    }
+
+    s->events = config->edge_events;
+    s->sda_level = (wire_levels(s->wire) & s->sda_mask) == s->sda_mask;
+    s->scl_level = (wire_levels(s->wire) & s->scl_mask) != 0;
+    printf("Simulated wire: %s (endpoint %d)\n", path, s->slot);
+
+    config->line_priv = s;
+    return 0;
+}
+
+static void sim_close(I2C_Config *config) {
+    SimLines *s = config->line_priv;
+    SimEndpoint *self = &s->wire->ep[s->slot];
+
+    atomic_store(&self->low, 0);
+    atomic_store(&self->pid, 0);
+    wire_publish(s->wire);
+    munmap(s->wire, sizeof(SimWire));
+    close(s->fd);
+    free(s);
+    config->line_priv = NULL;
+}
+
+static void sim_set_sda(I2C_Config *config, int value) {
+    SimLines *s = config->line_priv;
+    wire_drive(config, s->sda_mask, value ? s->sda_mask : 0);
+}
+
+static void sim_set_scl(I2C_Config *config, int value) {
+    SimLines *s = config->line_priv;
+    wire_drive(config, s->scl_mask, value ? s->scl_mask : 0);
+}
+
+static int sim_read_lines(I2C_Config *config, int *sda, int *scl) {
+    SimLines *s = config->line_priv;
+    uint32_t seq = atomic_load(&s->wire->seq);
+    uint32_t levels = wire_levels(s->wire);
+
+    if (!s->events) {
+        atomic_store(&s->wire->ep[s->slot].seen, seq);
+    }
+    *sda = (levels & s->sda_mask) == s->sda_mask;
+    *scl = (levels & s->scl_mask) != 0;
+    return 0;
+}
+
+// Wide bus: the SDA lines are bits of the same wire word, so one store
+// drives all of them and one load samples them
+static void sim_set_sda_lines(I2C_Config *config, uint32_t levels) {
+    SimLines *s = config->line_priv;
+    uint32_t high = 0;
+
+    for (int n = 0; n < s->width; n++) {
+        if (levels & (1u << n)) {
+            high |= 1u << s->sda_pins[n];
+        }
+    }
+    wire_drive(config, s->sda_mask, high);
+}
+
+static int sim_read_sda_lines(I2C_Config *config, uint32_t *levels, int *scl) {
+    SimLines *s = config->line_priv;
+    uint32_t seq = atomic_load(&s->wire->seq);
+    uint32_t wire = wire_levels(s->wire);
+
+    if (!s->events) {
+        atomic_store(&s->wire->ep[s->slot].seen, seq);
+    }
+    *levels = 0;
+    for (int n = 0; n < s->width; n++) {
+        *levels |= ((wire >> s->sda_pins[n]) & 1) << n;
+    }
+    *scl = (wire & s->scl_mask) != 0;
+    return 0;
+}
+
+// Bit timing on the wire comes from the lockstep, so the sim sleeps rather
+// than spinning in the delay engine, which could starve the peer endpoint
+// on a single core. Zero-length delays still yield for the same reason.
+static void sim_delay(I2C_Config *config, int us) {
+    (void)config;
+    if (us <= 0) {
+        sched_yield();
+    } else {
+        usleep(us);
+    }
+}
+
+// Return the line changes logged since the last call. Changes that are
+// not edges of SDA/SCL are acknowledged right away; the others only on the
+// next call, so a writer cannot move on before the edges were decoded.
+static int sim_read_edges(I2C_Config *config, I2C_Edge *edges, int max, int timeout_us) {
+    SimLines *s = config->line_priv;
+    SimWire *wire = s->wire;
+    SimEndpoint *self = &wire->ep[s->slot];
+    uint64_t start = now_us();
+    int n = 0;
+
+    // Everything returned by the previous call has been decoded by now
+    atomic_store(&self->seen, s->ev_seq);
+
+    for (;;) {
+        uint32_t seq = atomic_load(&wire->seq);
+
+        while (n < max && s->ev_seq != seq) {
+            SimLogEntry *entry = &wire->log[(s->ev_seq + 1) % I2C_SIM_LOG_SIZE];
+            uint32_t stamp = atomic_load(&entry->stamp);
+            uint32_t levels = entry->levels;
+            uint64_t ts_ns = entry->ts_ns;
+
+            if (stamp != s->ev_seq + 1 || atomic_load(&entry->stamp) != stamp) {
+                if ((int32_t)(stamp - (s->ev_seq + 1)) < 0) {
+                    break;  // Writer has not finished the entry yet
+                }
+                // Fell a whole ring behind: resync to the current levels
+                fprintf(stderr, "Sim wire: edge log overrun, resyncing\n");
+                s->ev_seq = seq;
+                levels = wire_levels(wire);
+                ts_ns = now_us() * 1000;
+            } else {
+                s->ev_seq++;
+            }
+
+            int sda = (levels & s->sda_mask) == s->sda_mask;
+            int scl = (levels & s->scl_mask) != 0;
+            if (sda != s->sda_level || scl != s->scl_level) {
+                edges[n].ts_ns = ts_ns;
+                edges[n].sda = sda;
+                edges[n].scl = scl;
+                s->sda_level = sda;
+                s->scl_level = scl;
+                n++;
+            }
+        }
+
+        if (n > 0) {
+            return n;
+        }
+        atomic_store(&self->seen, s->ev_seq);
+
+        uint64_t waited = now_us() - start;
+        if (waited >= (uint64_t)timeout_us) {
+            return 0;
+        }
+        if (waited < I2C_SIM_EVENT_SPIN_US) {
+            sched_yield();
+        } else {
+            usleep(I2C_SIM_EVENT_POLL_US);
+        }
+    }
+}
+
+// Auxiliary lines are further pins of the same wire. They are not part of
+// the lockstep: nothing samples them bit by bit, so a change is published
+// without waiting for the other endpoints.
+static int sim_aux_open(I2C_Config *config, int pin, int dir) {
+    (void)config;
+    (void)dir;
+
+    if (pin > I2C_SIM_MAX_PIN) {
+        fprintf(stderr, "Simulated wire only supports pins 0-%d\n", I2C_SIM_MAX_PIN);
+        return -1;
+    }
+    return 0;
+}
+
+static void sim_aux_set(I2C_Config *config, int pin, int value) {
+    SimLines *s = config->line_priv;
+    SimEndpoint *self = &s->wire->ep[s->slot];
+    uint32_t mask = 1u << pin;
+
+    if (value) {
+        atomic_fetch_and(&self->low, ~mask);
+    } else {
+        atomic_fetch_or(&self->low, mask);
+    }
+    wire_publish(s->wire);
+}
+
+static int sim_aux_wait(I2C_Config *config, int pin, int value, int timeout_us) {
+    SimLines *s = config->line_priv;
+    uint64_t start = now_us();
+
+    for (;;) {
+        if (((wire_levels(s->wire) >> pin) & 1) == (uint32_t)value) {
+            return 1;
+        }
+        if (now_us() - start >= (uint64_t)timeout_us) {
+            return 0;
+        }
+        // Waiting counts as sampling SDA/SCL, as in wire_sync. A plain
+        // read (no timeout) does not, as it may come from another thread.
+        if (!s->events) {
+            atomic_store(&s->wire->ep[s->slot].seen, atomic_load(&s->wire->seq));
+        }
+        usleep(I2C_SIM_AUX_POLL_US);
+    }
+}
+
+const I2C_LineOps i2c_sim_ops = {
+    .name = "sim",
+    .max_pin = I2C_SIM_MAX_PIN,
+    .open = sim_open,
+    .close = sim_close,
+    .set_sda = sim_set_sda,
+    .set_scl = sim_set_scl,
+    .read_lines = sim_read_lines,
+    .set_sda_dir = NULL,
+    .delay = sim_delay,
+    .read_edges = sim_read_edges,
+    .aux_open = sim_aux_open,
+    .aux_set = sim_aux_set,
+    .aux_wait = sim_aux_wait,
+    .set_sda_lines = sim_set_sda_lines,
+    .read_sda_lines = sim_read_sda_lines,
+};
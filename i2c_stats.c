@@ -0,0 +1,63 @@
+// i2c_stats.c - Latency sample collection and percentiles
+#include "i2c_stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define I2C_LATENCY_INITIAL 1024  // First allocation, doubled as needed
+
+void i2c_latency_init(I2C_Latency *lat) {
+    memset(lat, 0, sizeof(*lat));
+}
+
+void i2c_latency_free(I2C_Latency *lat) {
+    free(lat->ns);
+    memset(lat, 0, sizeof(*lat));
+}
+
+int i2c_latency_add(I2C_Latency *lat, uint64_t ns) {
+    if (lat->count == lat->capacity) {
+        size_t capacity = lat->capacity ? lat->capacity * 2 : I2C_LATENCY_INITIAL;
+        uint64_t *grown = realloc(lat->ns, capacity * sizeof(*grown));
+        if (!grown) {
+            return -1;
+        }
+        lat->ns = grown;
+        lat->capacity = capacity;
+    }
+    lat->ns[lat->count++] = ns;
+    lat->sorted = 0;
+    return 0;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile
+uint64_t i2c_latency_percentile(I2C_Latency *lat, double p) {
+    if (lat->count == 0) {
+        return 0;
+    }
+    if (!lat->sorted) {
+        qsort(lat->ns, lat->count, sizeof(lat->ns[0]), compare_u64);
+        lat->sorted = 1;
+    }
+    
+    size_t rank = (size_t)(p / 100.0 * lat->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > lat->count) {
+        rank = lat->count;
+    }
+    return lat->ns[rank - 1];
+}
+
+uint64_t i2c_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,27 @@
+// i2c_stats.h - Latency sample collection and percentiles
+#ifndef I2C_STATS_H
+#define I2C_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+    uint64_t *ns;      // Samples in nanoseconds
+    size_t count;
+    size_t capacity;
+    int sorted;
+} I2C_Latency;
+
+void i2c_latency_init(I2C_Latency *lat);
+void i2c_latency_free(I2C_Latency *lat);
+
+// Add one sample; returns -1 if out of memory
+int i2c_latency_add(I2C_Latency *lat, uint64_t ns);
+
+// Sample at percentile p (0-100), 0 when empty
+uint64_t i2c_latency_percentile(I2C_Latency *lat, double p);
+
+// Monotonic time in nanoseconds, for timing samples
+uint64_t i2c_now_ns(void);
+
+#endif // I2C_STATS_H
@@ -0,0 +1,121 @@
+// i2c_trace.c - Bit-level flight recorder for SDA/SCL
+//
+// soft_i2c.c records every change of the sampled or driven line levels
+// into a ring when config->trace is set. On a failure the programs dump
+// the last few milliseconds before it as a Value Change Dump, so the bits
+// that led to a NACK, timeout or resync can be looked at in a waveform
+// viewer instead of being reconstructed from a single line status print.
+#include "i2c_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACE_SIGNALS 4  // Wire and driven level of SDA and SCL
+
+// VCD identifiers of the traced signals
+static const char *const signal_names[] = { "sda", "scl", "sda_drive", "scl_drive" };
+static const char signal_ids[] = { '!', '"', '#', '$' };
+
+static void sample_levels(const I2C_TraceSample *s, int levels[TRACE_SIGNALS]) {
+    levels[0] = s->sda;
+    levels[1] = s->scl;
+    levels[2] = s->sda_out;
+    levels[3] = s->scl_out;
+}
+
+int i2c_trace_init(I2C_Trace *trace, const char *prefix, int window_ms) {
+    memset(trace, 0, sizeof(*trace));
+
+    trace->samples = malloc(I2C_TRACE_SIZE * sizeof(I2C_TraceSample));
+    if (!trace->samples) {
+        fprintf(stderr, "Failed to allocate the line trace\n");
+        return -1;
+    }
+    // Touch every page now rather than on the first pass of the bus loop
+    memset(trace->samples, 0, I2C_TRACE_SIZE * sizeof(I2C_TraceSample));
+
+    // Idle bus: both lines released and high
+    trace->last.sda = trace->last.scl = 1;
+    trace->last.sda_out = trace->last.scl_out = 1;
+    trace->prefix = prefix;
+    trace->window_ms = window_ms;
+    return 0;
+}
+
+void i2c_trace_free(I2C_Trace *trace) {
+    free(trace->samples);
+    trace->samples = NULL;
+}
+
+int i2c_trace_dump(I2C_Trace *trace, const char *reason) {
+    char path[256];
+    int levels[TRACE_SIGNALS], prev[TRACE_SIGNALS];
+
+    trace->failures++;
+    if (trace->count == 0 || trace->dumps >= I2C_TRACE_MAX_DUMPS) {
+        return 0;
+    }
+
+    // Oldest sample inside the window before now, as far back as the ring
+    // goes, but no fewer than I2C_TRACE_MIN_DUMP
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    uint64_t window_ns = (uint64_t)trace->window_ms * 1000000ULL;
+    uint64_t kept = trace->count < I2C_TRACE_SIZE ? trace->count : I2C_TRACE_SIZE;
+    uint64_t first = trace->count - 1;
+    while (first > trace->count - kept &&
+           (trace->count - first < I2C_TRACE_MIN_DUMP ||
+            now_ns - trace->samples[(first - 1) & (I2C_TRACE_SIZE - 1)].ts_ns <= window_ns)) {
+        first--;
+    }
+
+    snprintf(path, sizeof(path), "%s_%d_%d.vcd", trace->prefix, (int)getpid(), trace->dumps);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    trace->dumps++;
+
+    const I2C_TraceSample *start = &trace->samples[first & (I2C_TRACE_SIZE - 1)];
+    fprintf(f, "$comment %s, failure %lu, %llu samples $end\n", reason, trace->failures,
+            (unsigned long long)(trace->count - first));
+    fprintf(f, "$comment t = 0 is CLOCK_MONOTONIC %llu ns $end\n", (unsigned long long)start->ts_ns);
+    fprintf(f, "$timescale 1ns $end\n");
+    fprintf(f, "$scope module i2c $end\n");
+    for (int i = 0; i < TRACE_SIGNALS; i++) {
+        fprintf(f, "$var wire 1 %c %s $end\n", signal_ids[i], signal_names[i]);
+    }
+    fprintf(f, "$upscope $end\n$enddefinitions $end\n");
+
+    // Initial values, then only what changed
+    sample_levels(start, prev);
+    fprintf(f, "#0\n$dumpvars\n");
+    for (int i = 0; i < TRACE_SIGNALS; i++) {
+        fprintf(f, "%d%c\n", prev[i], signal_ids[i]);
+    }
+    fprintf(f, "$end\n");
+
+    uint64_t t_prev = 0;
+    for (uint64_t n = first + 1; n < trace->count; n++) {
+        const I2C_TraceSample *s = &trace->samples[n & (I2C_TRACE_SIZE - 1)];
+        uint64_t t = s->ts_ns - start->ts_ns;
+        sample_levels(s, levels);
+        if (t != t_prev) {
+            fprintf(f, "#%llu\n", (unsigned long long)t);
+            t_prev = t;
+        }
+        for (int i = 0; i < TRACE_SIGNALS; i++) {
+            if (levels[i] != prev[i]) {
+                fprintf(f, "%d%c\n", levels[i], signal_ids[i]);
+                prev[i] = levels[i];
+            }
+        }
+    }
+
+    fclose(f);
+    fprintf(stderr, "Trace: %s, last %d ms written to %s\n", reason, trace->window_ms, path);
+    return 0;
+}
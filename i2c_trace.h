@@ -0,0 +1,73 @@
+// i2c_trace.h - Bit-level flight recorder for SDA/SCL
+#ifndef I2C_TRACE_H
+#define I2C_TRACE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define I2C_TRACE_SIZE      65536  // Samples kept, a power of two (1 MiB)
+#define I2C_TRACE_MAX_DUMPS 16     // Dump files written per run
+#define I2C_TRACE_MIN_DUMP  256    // Samples dumped even if older than the window
+
+// Line state after a change: the levels on the wire (as last sampled, or
+// as driven when this end changed a line since) and the levels this end
+// drives (0 = pulling low, 1 = released)
+typedef struct {
+    uint64_t ts_ns;  // CLOCK_MONOTONIC
+    uint8_t sda;
+    uint8_t scl;
+    uint8_t sda_out;
+    uint8_t scl_out;
+} I2C_TraceSample;
+
+// Ring of the most recent line changes. Written and dumped by the bus
+// thread only; a sample is only stored when one of the four levels
+// changed, so polling loops cost a compare.
+typedef struct {
+    I2C_TraceSample *samples;
+    uint64_t count;        // Samples recorded since start
+    I2C_TraceSample last;  // Most recent sample
+    const char *prefix;    // Dump files are <prefix>_<pid>_<n>.vcd
+    int window_ms;         // Time before the failure that is dumped
+    int dumps;             // Failures dumped so far
+    unsigned long failures;  // Failures reported, dumped or not
+} I2C_Trace;
+
+// Allocate the ring. Returns -1 if out of memory.
+int i2c_trace_init(I2C_Trace *trace, const char *prefix, int window_ms);
+void i2c_trace_free(I2C_Trace *trace);
+
+// Record the line state at ts_ns (0 = now) if it changed
+static inline void i2c_trace_record(I2C_Trace *trace, uint64_t ts_ns,
+                                    int sda, int scl, int sda_out, int scl_out) {
+    I2C_TraceSample *last = &trace->last;
+
+    if (last->sda == sda && last->scl == scl && last->sda_out == sda_out && last->scl_out == scl_out) {
+        return;
+    }
+    if (ts_ns == 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+    // Edge timestamps come from the backend and may trail our own clock
+    if (ts_ns < last->ts_ns) {
+        ts_ns = last->ts_ns;
+    }
+
+    last->ts_ns = ts_ns;
+    last->sda = sda;
+    last->scl = scl;
+    last->sda_out = sda_out;
+    last->scl_out = scl_out;
+    trace->samples[trace->count++ & (I2C_TRACE_SIZE - 1)] = *last;
+}
+
+// Write the samples of the last window_ms as a VCD file (GTKWave,
+// sigrok) with reason as comment. At least I2C_TRACE_MIN_DUMP samples are
+// written, so a failure after the lines were stuck for longer than the
+// window still shows what led to it. Past I2C_TRACE_MAX_DUMPS files the
+// failure is only counted. Returns -1 if the file cannot be written.
+int i2c_trace_dump(I2C_Trace *trace, const char *reason);
+
+#endif // I2C_TRACE_H
@@ -4,158 +4,869 @@
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include "soft_i2c.h"
+#include "i2c_rt.h"
+#include "i2c_rate.h"
+#include "i2c_stats.h"
+#include "i2c_log.h"
 #include "vl53l0x_io.h"
 
 volatile int running = 1;
 
+// One bus the master drives: its lines, the sensors on it and the
+// statistics of its measurement cycles. With several buses each runs its
+// cycles on a worker thread of its own.
+typedef struct {
+    int index;
+    I2C_Config config;
+    I2C_Trace trace;  // Line flight recorder, used when -T is given
+    char trace_prefix[40];
+    char log_prefix[24];
+    I2C_Latency latency;
+    I2C_RateController rate_controller;
+    
+    // Sensors on the bus, measured in turn
+    uint8_t sensor_addresses[VL53L0X_MAX_SENSORS];
+    int interrupt;  // Waiting for data-ready, unless its setup failed
+    
+    // Results
+    int cycles;
+    int successful;
+    double elapsed_s;
+    
+    // Worker thread: started one at a time, then all let go together
+    pthread_t thread;
+    sem_t ready;
+    sem_t go;
+    int status;
+} MasterBus;
+
+static MasterBus buses[VL53L0X_MAX_BUSES];
+static I2C_Config *bus_configs[VL53L0X_MAX_BUSES];  // &buses[b].config
+static int bus_count = 1;
+
+// Adaptive bit rate controller of the calling thread's bus, NULL when disabled
+static __thread I2C_RateController *rate;
+
+// Latency of every register transaction on the calling thread's bus
+static __thread I2C_Latency *latency;
+
+// Settings of all buses, from vl53l0x_io.h unless given on the command line
+static I2C_RtProfile rt;
+static int measurement_frequency_hz = MEASUREMENT_FREQUENCY_HZ;
+static int measurement_delay_us;
+static int max_measurements = MAX_MEASUREMENTS;
+static int sensor_count = 1;
+static int xshut_pin = -1;
+static int interrupt = 0;
+static int continuous = 0;
+static int adaptive = 0;
+static int trace_window_ms = 0;
+static int wide_pins[I2C_WIDE_MAX];  // -W: SDA lines of the wide bus
+static int wide_count = 0;
+
+// Start of the measurement loops, the time base of the merged output
+static uint64_t loop_start;
+
 void handle_signal(int sig) {
     (void)sig;
     running = 0;
 }
 
-// Read a single register from VL53L0X
-int vl53l0x_read_register(I2C_Config *config, uint8_t reg_addr, uint8_t *value) {
-    // Write register address
-    if (i2c_master_write(config, &reg_addr, 1) < 0) {
-        return -1;
+// Feed a transaction outcome to the bit rate controller, if enabled
+static void rate_record(I2C_Config *config, int outcome) {
+    if (rate) {
+        i2c_rate_record(rate, config, outcome);
     }
+}
+
+// Sensors a transaction reaches at once: one per SDA line of a wide bus
+static int bus_lines(const I2C_Config *config) {
+    return config->width > 1 ? config->width : 1;
+}
+
+// Dump the last moments of the bus, if the flight recorder is enabled
+static void trace_failure(I2C_Config *config, const char *reason) {
+    if (config->trace) {
+        i2c_trace_dump(config->trace, reason);
+    }
+}
+
+// Read consecutive registers from VL53L0X in one burst; the device
+// auto-increments the register address after each byte. On a wide bus
+// values holds count bytes per line, line n's at values + n * count.
+int vl53l0x_read_registers(I2C_Config *config, uint8_t reg_addr, uint8_t *values, int count) {
+    uint64_t start = i2c_now_ns();
+    
+    // Write register address, then read the register values after a
+    // repeated START
+    int result = i2c_master_write_read(config, &reg_addr, 1, values, count);
     
-    usleep(WRITE_READ_DELAY_US);  // Delay between write and read for software I2C
+    i2c_latency_add(latency, i2c_now_ns() - start);
+    if (result < 0) {
+        trace_failure(config, "register read failed");
+    }
+    return result;
+}
+
+// Read a single register from VL53L0X (one per line on a wide bus)
+int vl53l0x_read_register(I2C_Config *config, uint8_t reg_addr, uint8_t *value) {
+    return vl53l0x_read_registers(config, reg_addr, value, 1);
+}
+
+// Write consecutive registers to VL53L0X in one transaction
+int vl53l0x_write_registers(I2C_Config *config, uint8_t reg_addr, const uint8_t *values, int count) {
+    uint8_t data[1 + VL53L0X_MAX_WRITE];
     
-    // Read register value
-    if (i2c_master_read(config, value, 1) < 0) {
+    if (count > VL53L0X_MAX_WRITE) {
+        fprintf(stderr, "Register write of %d bytes exceeds %d\n", count, VL53L0X_MAX_WRITE);
         return -1;
     }
+    data[0] = reg_addr;
+    memcpy(data + 1, values, count);
     
-    return 0;
+    uint64_t start = i2c_now_ns();
+    int result = i2c_master_write(config, data, 1 + count);
+    
+    i2c_latency_add(latency, i2c_now_ns() - start);
+    if (result < 0) {
+        trace_failure(config, "register write failed");
+    }
+    return result;
 }
 
 // Write a single register to VL53L0X
 int vl53l0x_write_register(I2C_Config *config, uint8_t reg_addr, uint8_t value) {
-    uint8_t data[2] = {reg_addr, value};
-    return i2c_master_write(config, data, 2);
+    return vl53l0x_write_registers(config, reg_addr, &value, 1);
 }
 
-// Read 16-bit distance value (big-endian)
-int vl53l0x_read_distance(I2C_Config *config, uint16_t *distance_mm) {
-    uint8_t high_byte, low_byte;
+// Route "new sample ready" to GPIO1, active low, and clear any pending
+// interrupt, so the line falls when the next measurement completes
+int vl53l0x_setup_interrupt(I2C_Config *config) {
+    uint8_t mux;
     
-    // Read high byte
-    if (vl53l0x_read_register(config, VL53L0X_REG_RESULT_RANGE_VAL, &high_byte) < 0) {
+    if (vl53l0x_write_register(config, VL53L0X_REG_SYSTEM_INTERRUPT_CONFIG_GPIO,
+                               VL53L0X_INT_NEW_SAMPLE_READY) < 0) {
+        return -1;
+    }
+    usleep(SETUP_GAP_US);
+    if (vl53l0x_read_register(config, VL53L0X_REG_GPIO_HV_MUX_ACTIVE_HIGH, &mux) < 0 ||
+        vl53l0x_write_register(config, VL53L0X_REG_GPIO_HV_MUX_ACTIVE_HIGH,
+                               mux & ~VL53L0X_GPIO_ACTIVE_HIGH) < 0) {
+        return -1;
+    }
+    usleep(SETUP_GAP_US);
+    if (vl53l0x_write_register(config, VL53L0X_REG_SYSTEM_INTERRUPT_CLEAR, 0x01) < 0) {
         return -1;
     }
+    usleep(SETUP_GAP_US);
+    return 0;
+}
+
+// Bring up count sensors that all boot at VL53L0X_ADDR: hold every one in
+// reset through its XSHUT line, then release them one at a time and move
+// each to VL53L0X_ARRAY_ADDR + n before the next one boots
+int vl53l0x_assign_addresses(I2C_Config *config, int count, int first_xshut, uint8_t *addresses) {
+    uint8_t model_id;
+    
+    for (int n = 0; n < count; n++) {
+        if (i2c_aux_open(config, first_xshut + n, I2C_DIR_OUT) < 0) {
+            fprintf(stderr, "Failed to set up XSHUT output on GPIO%d\n", first_xshut + n);
+            return -1;
+        }
+        i2c_aux_write(config, first_xshut + n, 0);
+    }
+    usleep(XSHUT_BOOT_US);
     
-    // Read low byte
-    if (vl53l0x_read_register(config, VL53L0X_REG_RESULT_RANGE_VAL + 1, &low_byte) < 0) {
+    for (int n = 0; n < count; n++) {
+        uint8_t address = VL53L0X_ARRAY_ADDR + n;
+        
+        i2c_aux_write(config, first_xshut + n, 1);
+        usleep(XSHUT_BOOT_US);
+        
+        config->slave_address = VL53L0X_ADDR;
+        if (vl53l0x_write_register(config, VL53L0X_REG_I2C_SLAVE_DEVICE_ADDRESS, address) < 0) {
+            fprintf(stderr, "Sensor %d does not answer at 0x%02X\n", n, VL53L0X_ADDR);
+            return -1;
+        }
+        usleep(SETUP_GAP_US);
+        
+        config->slave_address = address;
+        if (vl53l0x_read_register(config, VL53L0X_REG_IDENTIFICATION_MODEL_ID, &model_id) < 0 ||
+            model_id != VL53L0X_MODEL_ID) {
+            fprintf(stderr, "Sensor %d not found at 0x%02X\n", n, address);
+            return -1;
+        }
+        usleep(SETUP_GAP_US);
+        
+        addresses[n] = address;
+        printf("Sensor %d: XSHUT GPIO%d, address 0x%02X\n", n, first_xshut + n, address);
+    }
+    return 0;
+}
+
+// Read range status and 16-bit distance value (big-endian) in one burst;
+// on a wide bus entry n of each is line n's
+int vl53l0x_read_result(I2C_Config *config, uint8_t *status, uint16_t *distance_mm) {
+    uint8_t blocks[I2C_WIDE_MAX][VL53L0X_RESULT_BLOCK_SIZE];
+    int offset = VL53L0X_REG_RESULT_RANGE_VAL - VL53L0X_REG_RESULT_RANGE_STATUS;
+    
+    if (vl53l0x_read_registers(config, VL53L0X_REG_RESULT_RANGE_STATUS, blocks[0], sizeof(blocks[0])) < 0) {
         return -1;
     }
     
-    *distance_mm = (high_byte << 8) | low_byte;
+    for (int n = 0; n < bus_lines(config); n++) {
+        status[n] = blocks[n][0];
+        distance_mm[n] = (blocks[n][offset] << 8) | blocks[n][offset + 1];
+    }
     return 0;
 }
 
-int main(int argc, char *argv[]) {
-    (void)argc;
-    (void)argv;
+// Read interrupt status, range status and distance in one burst, which is
+// all a sample takes in continuous mode; one entry per line as above
+int vl53l0x_read_sample(I2C_Config *config, uint8_t *interrupt_status, uint8_t *status, uint16_t *distance_mm) {
+    uint8_t blocks[I2C_WIDE_MAX][1 + VL53L0X_RESULT_BLOCK_SIZE];
+    int offset = VL53L0X_REG_RESULT_RANGE_VAL - VL53L0X_REG_RESULT_INTERRUPT_STATUS;
     
-    I2C_Config config;
-    uint8_t model_id, revision_id;
-    uint8_t status;
-    uint16_t distance_mm;
-    int cycle = 0;
-    int successful_measurements = 0;
+    if (vl53l0x_read_registers(config, VL53L0X_REG_RESULT_INTERRUPT_STATUS, blocks[0], sizeof(blocks[0])) < 0) {
+        return -1;
+    }
     
-    signal(SIGINT, handle_signal);
+    for (int n = 0; n < bus_lines(config); n++) {
+        interrupt_status[n] = blocks[n][0];
+        status[n] = blocks[n][VL53L0X_REG_RESULT_RANGE_STATUS - VL53L0X_REG_RESULT_INTERRUPT_STATUS];
+        distance_mm[n] = (blocks[n][offset] << 8) | blocks[n][offset + 1];
+    }
+    return 0;
+}
+
+// Start timed ranging: the sensor measures every period_ms on its own
+int vl53l0x_start_continuous(I2C_Config *config, uint32_t period_ms) {
+    uint8_t period[4] = {period_ms >> 24, period_ms >> 16, period_ms >> 8, period_ms};
     
-    // Configure I2C
-    config.sda_pin = SDA_PIN;
-    config.scl_pin = SCL_PIN;
-    config.slave_address = VL53L0X_ADDR;
-    config.bit_delay = I2C_BIT_DELAY_US;
+    if (vl53l0x_write_registers(config, VL53L0X_REG_SYSTEM_INTERMEASUREMENT_PERIOD, period, sizeof(period)) < 0) {
+        return -1;
+    }
+    usleep(SETUP_GAP_US);
+    return vl53l0x_write_register(config, VL53L0X_REG_SYSRANGE_START, VL53L0X_SYSRANGE_TIMED);
+}
+
+
+// One-line machine-readable summary, parsed by timing_sweep (which takes
+// the last line starting with '{', so per-bus lines carry their prefix).
+// bit_delay_us is left out when bit_delay is negative.
+static void print_json_summary(const char *prefix, int bit_delay, int cycles, int successful,
+                               double elapsed_s, I2C_Latency *lat) {
+    printf("%s{", prefix);
+    if (bit_delay >= 0) {
+        printf("\"bit_delay_us\":%d,", bit_delay);
+    }
+    printf("\"frequency_hz\":%d,\"cycles\":%d,\"successful\":%d,"
+           "\"success_rate\":%.2f,\"elapsed_s\":%.3f,\"measurements_per_s\":%.3f,"
+           "\"transactions\":%zu,\"latency_us\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f}}\n",
+           measurement_frequency_hz, cycles, successful,
+           cycles ? successful * 100.0 / cycles : 0.0, elapsed_s,
+           elapsed_s > 0 ? successful / elapsed_s : 0.0, lat->count,
+           i2c_latency_percentile(lat, 50) / 1000.0, i2c_latency_percentile(lat, 90) / 1000.0,
+           i2c_latency_percentile(lat, 99) / 1000.0, i2c_latency_percentile(lat, 100) / 1000.0);
+}
+
+// Bring up a bus: real-time profile of its thread, lines, sensor
+// addresses, identification, interrupt lines and continuous ranging.
+// Cleans up after itself on failure.
+static int bus_start(MasterBus *bus) {
+    I2C_Config *config = &bus->config;
+    I2C_RtProfile bus_rt = rt;
+    int first_line = bus->index * sensor_count;  // Aux lines of bus b follow those of bus b - 1
+    uint8_t model_id[I2C_WIDE_MAX], revision_id[I2C_WIDE_MAX];
+    
+    latency = &bus->latency;
+    i2c_latency_init(latency);
+    bus->sensor_addresses[0] = VL53L0X_ADDR;
+    bus->interrupt = interrupt;
+    
+    // Real-time profile before init, so the delay engine calibrates under it
+    bus_rt.cpu = i2c_rt_thread_cpu(&rt, bus->index);
+    if (i2c_rt_apply(&bus_rt) < 0) {
+        return -1;
+    }
+    
+    if (trace_window_ms > 0) {
+        if (i2c_trace_init(&bus->trace, bus->trace_prefix, trace_window_ms) < 0) {
+            return -1;
+        }
+        config->trace = &bus->trace;
+    }
     
     // Initialize I2C
-    if (i2c_init(&config) < 0) {
+    if (i2c_init(config) < 0) {
         fprintf(stderr, "Failed to initialize I2C\n");
-        return 1;
+        i2c_trace_free(&bus->trace);
+        return -1;
     }
     
-    printf("VL53L0X Master Test Program\n");
-    printf("Using SDA: GPIO%d, SCL: GPIO%d, VL53L0X address: 0x%02X\n", 
-           config.sda_pin, config.scl_pin, config.slave_address);
+    if (adaptive) {
+        i2c_rate_init(&bus->rate_controller, config, ADAPTIVE_MIN_BIT_DELAY_US, ADAPTIVE_MAX_BIT_DELAY_US);
+        rate = &bus->rate_controller;
+    }
+    
+    printf("%sUsing SDA: GPIO%d, SCL: GPIO%d, VL53L0X address: 0x%02X\n", bus->log_prefix,
+           config->sda_pin, config->scl_pin, config->slave_address);
+    
+    if (xshut_pin >= 0) {
+        printf("\n=== Sensor Addresses ===\n");
+        if (vl53l0x_assign_addresses(config, sensor_count, xshut_pin + first_line, bus->sensor_addresses) < 0) {
+            goto fail;
+        }
+        config->slave_address = bus->sensor_addresses[0];
+    }
     
     // Read device identification
     printf("\n=== Device Identification ===\n");
-    if (vl53l0x_read_register(&config, VL53L0X_REG_IDENTIFICATION_MODEL_ID, &model_id) == 0) {
-        printf("Model ID: 0x%02X\n", model_id);
+    if (vl53l0x_read_register(config, VL53L0X_REG_IDENTIFICATION_MODEL_ID, model_id) == 0) {
+        for (int n = 0; n < bus_lines(config); n++) {
+            printf("Model ID: 0x%02X\n", model_id[n]);
+        }
     } else {
         printf("Failed to read Model ID\n");
     }
     
-    if (vl53l0x_read_register(&config, VL53L0X_REG_IDENTIFICATION_REVISION_ID, &revision_id) == 0) {
-        printf("Revision ID: 0x%02X\n", revision_id);
+    if (vl53l0x_read_register(config, VL53L0X_REG_IDENTIFICATION_REVISION_ID, revision_id) == 0) {
+        for (int n = 0; n < bus_lines(config); n++) {
+            printf("Revision ID: 0x%02X\n", revision_id[n]);
+        }
     } else {
         printf("Failed to read Revision ID\n");
     }
     
-    printf("\n=== Starting Distance Measurements ===\n");
-    printf("Frequency: %d Hz, Period: %d ms\n", MEASUREMENT_FREQUENCY_HZ, MEASUREMENT_DELAY_US/1000);
+    for (int n = 0; bus->interrupt && n < sensor_count; n++) {
+        int int_pin = INT_PIN + first_line + n;
+        config->slave_address = bus->sensor_addresses[n];
+        if (i2c_aux_open(config, int_pin, I2C_DIR_IN) < 0 || vl53l0x_setup_interrupt(config) < 0) {
+            fprintf(stderr, "Failed to set up the data-ready interrupt, sleeping instead\n");
+            bus->interrupt = 0;
+        } else {
+            printf("Data-ready interrupt on GPIO%d\n", int_pin);
+        }
+    }
+    
+    if (bus_count == 1) {
+        printf("\n=== Starting Distance Measurements ===\n");
+        printf("Frequency: %d Hz, Period: %d ms\n", measurement_frequency_hz, measurement_delay_us/1000);
+    }
+    
+    // Each sensor is read every sensor_count cycles, so that is its period
+    for (int n = 0; continuous && n < sensor_count; n++) {
+        config->slave_address = bus->sensor_addresses[n];
+        if (vl53l0x_start_continuous(config, measurement_delay_us * sensor_count / 1000) < 0) {
+            fprintf(stderr, "Failed to start continuous ranging\n");
+            goto fail;
+        }
+        usleep(SETUP_GAP_US);
+        printf("Continuous ranging started\n");
+    }
+    return 0;
+    
+fail:
+    i2c_cleanup(config);
+    i2c_trace_free(&bus->trace);
+    i2c_latency_free(latency);
+    return -1;
+}
+
+// With several buses every sample is one line stamped with the time since
+// the measurement loops started, so the merged log of all workers reads as
+// a single stream of samples. A wide bus logs one line per SDA line.
+static void log_sample(MasterBus *bus, int sensor, const uint8_t *status, const uint16_t *distance_mm) {
+    if (bus->config.width > 1) {
+        for (int n = 0; n < bus->config.width; n++) {
+            i2c_log(I2C_LOG_INFO, "%10.6f s  SDA GPIO%d: %5d mm, range status 0x%02X\n",
+                    (i2c_now_ns() - loop_start) / 1e9, bus->config.sda_pins[n], distance_mm[n], status[n]);
+        }
+    } else if (bus_count > 1) {
+        i2c_log(I2C_LOG_INFO, "%10.6f s  sensor %d (0x%02X): %5d mm, range status 0x%02X\n",
+                (i2c_now_ns() - loop_start) / 1e9, sensor, bus->sensor_addresses[sensor], distance_mm[0], status[0]);
+    }
+}
+
+// A value of any line out of range marks the transfer as corrupted; either
+// array may be NULL
+static int bad_sample(const I2C_Config *config, const uint8_t *interrupt_status, const uint16_t *distance_mm) {
+    for (int n = 0; n < bus_lines(config); n++) {
+        if ((interrupt_status && (interrupt_status[n] & ~VL53L0X_INT_STATUS_MASK)) ||
+            (distance_mm && distance_mm[n] > VL53L0X_MAX_DISTANCE_MM)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Measurement cycles of one bus until -n cycles are done or SIGINT. With
+// several buses the individual steps are debug output.
+static void bus_measure(MasterBus *bus) {
+    I2C_Config *config = &bus->config;
+    int steps = bus_count > 1 || config->width > 1 ? I2C_LOG_DEBUG : I2C_LOG_INFO;
+    uint8_t status[I2C_WIDE_MAX];
+    uint16_t distance_mm[I2C_WIDE_MAX];
     
     // Main measurement loop
-    while (running && cycle < MAX_MEASUREMENTS) {
-        float current_success_rate = cycle > 0 ? (successful_measurements * 100.0) / cycle : 0.0;
-        printf("\n--- Measurement Cycle %d/%d (%.1f%%) - Success rate: %.1f%% ---\n", 
-               cycle + 1, MAX_MEASUREMENTS, ((cycle + 1) * 100.0) / MAX_MEASUREMENTS, current_success_rate);
-        cycle++;
+    while (running && bus->cycles < max_measurements) {
+        float current_success_rate = bus->cycles > 0 ? (bus->successful * 100.0) / bus->cycles : 0.0;
+        i2c_log(steps, "\n--- Measurement Cycle %d/%d (%.1f%%) - Success rate: %.1f%% ---\n",
+                bus->cycles + 1, max_measurements, ((bus->cycles + 1) * 100.0) / max_measurements,
+                current_success_rate);
         
-        // Start single measurement
-        printf("1. Starting measurement...\n");
-        if (vl53l0x_write_register(&config, VL53L0X_REG_SYSRANGE_START, 0x01) < 0) {
-            printf("   Failed to start measurement\n");
-            sleep(1);
-            continue;
+        // One sensor per cycle, in turn
+        int sensor = bus->cycles % sensor_count;
+        int int_pin = INT_PIN + bus->index * sensor_count + sensor;
+        config->slave_address = bus->sensor_addresses[sensor];
+        if (sensor_count > 1) {
+            i2c_log(steps, "Sensor %d (0x%02X)\n", sensor, config->slave_address);
         }
+        bus->cycles++;
         
-        // Wait for measurement to complete - simplified approach
-        printf("2. Waiting for measurement completion...\n");
-        usleep(MEASUREMENT_DELAY_US);  // Fixed delay for measurement
+        // The sensor ranges on its own: wait for the next sample and fetch
+        // it with a single read
+        if (continuous) {
+            i2c_log(steps, "1. Waiting for sample...\n");
+            if (bus->interrupt) {
+                uint64_t wait_start = i2c_now_ns();
+                if (i2c_aux_wait(config, int_pin, 0, INT_WAIT_TIMEOUT_US) == 1) {
+                    i2c_log(steps, "   Data ready after %.2f ms\n", (i2c_now_ns() - wait_start) / 1e6);
+                } else {
+                    i2c_log(steps, "   No interrupt, reading anyway\n");
+                }
+            } else {
+                usleep(measurement_delay_us);
+            }
+            
+            uint8_t interrupt_status[I2C_WIDE_MAX];
+            if (vl53l0x_read_sample(config, interrupt_status, status, distance_mm) == 0) {
+                int bad = bad_sample(config, interrupt_status, distance_mm);
+                rate_record(config, bad ? I2C_RATE_BAD_DATA : I2C_RATE_OK);
+                i2c_log(steps, "2. Interrupt status: 0x%02X, range status: 0x%02X\n", interrupt_status[0], status[0]);
+                i2c_log(steps, "3. Distance: %d mm\n", distance_mm[0]);
+                log_sample(bus, sensor, status, distance_mm);
+                bus->successful++;
+            } else {
+                rate_record(config, I2C_RATE_NACK);
+                i2c_log(I2C_LOG_ERROR, "2. Failed to read sample\n");
+            }
+            
+            if (bus->interrupt && vl53l0x_write_register(config, VL53L0X_REG_SYSTEM_INTERRUPT_CLEAR, 0x01) < 0) {
+                rate_record(config, I2C_RATE_NACK);
+                i2c_log(I2C_LOG_ERROR, "   Failed to clear interrupt\n");
+            }
+            continue;
+        }
         
-        uint8_t interrupt_status = 0;
-        if (vl53l0x_read_register(&config, VL53L0X_REG_RESULT_INTERRUPT_STATUS, &interrupt_status) < 0) {
-            printf("   Failed to read interrupt status\n");
+        // Start single measurement
+        i2c_log(steps, "1. Starting measurement...\n");
+        if (vl53l0x_write_register(config, VL53L0X_REG_SYSRANGE_START, 0x01) < 0) {
+            rate_record(config, I2C_RATE_NACK);
+            i2c_log(I2C_LOG_ERROR, "   Failed to start measurement\n");
             sleep(1);
             continue;
         }
+        rate_record(config, I2C_RATE_OK);
         
-        printf("   Measurement complete (interrupt status: 0x%02X)\n", interrupt_status);
-        
-        // Read range status
-        if (vl53l0x_read_register(&config, VL53L0X_REG_RESULT_RANGE_STATUS, &status) == 0) {
-            printf("3. Range status: 0x%02X\n", status);
+        // Wait for measurement to complete: on the interrupt line, which
+        // makes reading the interrupt status unnecessary, or a fixed delay
+        int ready = 0;
+        if (bus->interrupt) {
+            i2c_log(steps, "2. Waiting for data-ready interrupt...\n");
+            uint64_t wait_start = i2c_now_ns();
+            ready = i2c_aux_wait(config, int_pin, 0, INT_WAIT_TIMEOUT_US) == 1;
+            if (ready) {
+                i2c_log(steps, "   Data ready after %.2f ms\n", (i2c_now_ns() - wait_start) / 1e6);
+            } else {
+                i2c_log(steps, "   No interrupt, checking status\n");
+            }
         } else {
-            printf("3. Failed to read range status\n");
+            i2c_log(steps, "2. Waiting for measurement completion...\n");
+            usleep(measurement_delay_us);  // Fixed delay for measurement
         }
         
-        // Read distance measurement
-        if (vl53l0x_read_distance(&config, &distance_mm) == 0) {
-            printf("4. Distance: %d mm\n", distance_mm);
-            successful_measurements++;
+        if (!ready) {
+            uint8_t interrupt_status[I2C_WIDE_MAX] = {0};
+            if (vl53l0x_read_register(config, VL53L0X_REG_RESULT_INTERRUPT_STATUS, interrupt_status) < 0) {
+                rate_record(config, I2C_RATE_NACK);
+                i2c_log(I2C_LOG_ERROR, "   Failed to read interrupt status\n");
+                sleep(1);
+                continue;
+            }
+            
+            rate_record(config, bad_sample(config, interrupt_status, NULL) ? I2C_RATE_BAD_DATA : I2C_RATE_OK);
+            i2c_log(steps, "   Measurement complete (interrupt status: 0x%02X)\n", interrupt_status[0]);
+        }
+        
+        // Read range status and distance in one transaction
+        if (vl53l0x_read_result(config, status, distance_mm) == 0) {
+            rate_record(config, bad_sample(config, NULL, distance_mm) ? I2C_RATE_BAD_DATA : I2C_RATE_OK);
+            i2c_log(steps, "3. Range status: 0x%02X\n", status[0]);
+            i2c_log(steps, "4. Distance: %d mm\n", distance_mm[0]);
+            log_sample(bus, sensor, status, distance_mm);
+            bus->successful++;
         } else {
-            printf("4. Failed to read distance\n");
+            rate_record(config, I2C_RATE_NACK);
+            i2c_log(I2C_LOG_ERROR, "3. Failed to read range status and distance\n");
+        }
+        
+        // Release the interrupt line for the next measurement
+        if (bus->interrupt && vl53l0x_write_register(config, VL53L0X_REG_SYSTEM_INTERRUPT_CLEAR, 0x01) < 0) {
+            rate_record(config, I2C_RATE_NACK);
+            i2c_log(I2C_LOG_ERROR, "   Failed to clear interrupt\n");
         }
         
         // Small delay before next measurement
-        usleep(MEASUREMENT_DELAY_US);
+        usleep(measurement_delay_us);
+    }
+    bus->elapsed_s = (i2c_now_ns() - loop_start) / 1e9;
+    
+    // A single-shot start stops continuous ranging, as in the ST API
+    for (int n = 0; continuous && n < sensor_count; n++) {
+        config->slave_address = bus->sensor_addresses[n];
+        if (vl53l0x_write_register(config, VL53L0X_REG_SYSRANGE_START, VL53L0X_SYSRANGE_SINGLESHOT) < 0) {
+            i2c_log(I2C_LOG_ERROR, "Failed to stop continuous ranging\n");
+        }
+        usleep(SETUP_GAP_US);
+    }
+}
+
+// Print the results of a bus and release it
+static void bus_report(MasterBus *bus, int json) {
+    I2C_Config *config = &bus->config;
+    const char *prefix = bus->log_prefix;
+    
+    printf("\n%s=== Test Results ===\n", prefix);
+    printf("%sTest frequency: %d Hz\n", prefix, measurement_frequency_hz);
+    printf("%sActual iterations: %d\n", prefix, bus->cycles);
+    printf("%sSuccessful: %d\n", prefix, bus->successful);
+    printf("%sSuccess rate: %.1f%%\n", prefix, (bus->successful * 100.0) / bus->cycles);
+    if (config->width > 1) {
+        printf("%sSensors per cycle: %d (measurements: %d)\n", prefix, config->width,
+               bus->successful * config->width);
+    }
+    printf("%sClock stretches: %lu (timeouts: %lu)\n", prefix, config->stretches, config->stretch_timeouts);
+    if (adaptive) {
+        i2c_rate_report(&bus->rate_controller, config);
+    }
+    printf("%sRegister transactions: %zu, latency p50 %.1f ms, p99 %.1f ms\n", prefix, bus->latency.count,
+           i2c_latency_percentile(&bus->latency, 50) / 1e6, i2c_latency_percentile(&bus->latency, 99) / 1e6);
+    // Every cycle of a wide bus measures each of its sensors
+    if (json) {
+        print_json_summary(prefix, config->bit_delay, bus->cycles * bus_lines(config),
+                           bus->successful * bus_lines(config), bus->elapsed_s, &bus->latency);
+    }
+}
+
+// Worker of one of several buses: brought up while the main thread waits,
+// measuring once all are up
+static void *bus_thread(void *arg) {
+    MasterBus *bus = arg;
+    sigset_t signals;
+    
+    // Leave SIGINT to the main thread
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    i2c_log_thread(bus->log_prefix);
+    
+    bus->status = bus_start(bus);
+    sem_post(&bus->ready);
+    if (bus->status < 0) {
+        return NULL;
+    }
+    
+    sem_wait(&bus->go);
+    bus_measure(bus);
+    return NULL;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-b gpiod|gpiomem|sim] [-d device] [-B sda:scl,...] [-W sda,...]\n"
+                    "          [-t us] [-f hz] [-n cycles] [-j] [-a] [-i] [-C] [-N sensors] [-X pin]\n"
+                    "          [-v level] [-T ms] [-r|-R] [-p prio] [-c cpu]\n", prog);
+    fprintf(stderr, "  -b  Line backend (default: gpiod)\n");
+    fprintf(stderr, "  -d  Backend device: gpiochip, GPIO register block (a regular file\n");
+    fprintf(stderr, "      is used as a fake one) or simulated wire file\n");
+    fprintf(stderr, "  -B  Measure on 1-%d buses in parallel, each on its SDA:SCL pin pair\n",
+            VL53L0X_MAX_BUSES);
+    fprintf(stderr, "      and worker thread, with one timestamped line per sample\n");
+    fprintf(stderr, "      (default: %d:%d)\n", SDA_PIN, SCL_PIN);
+    fprintf(stderr, "  -W  Wide bus: one sensor on each of 2-%d SDA lines sharing SCL\n", I2C_WIDE_MAX);
+    fprintf(stderr, "      GPIO%d, all measured at once by the same transfers\n", SCL_PIN);
+    fprintf(stderr, "  -t  Bit delay in microseconds (default: %d)\n", I2C_BIT_DELAY_US);
+    fprintf(stderr, "  -f  Measurement frequency in Hz (default: %d)\n", MEASUREMENT_FREQUENCY_HZ);
+    fprintf(stderr, "  -n  Number of measurement cycles, per bus (default: %d)\n", MAX_MEASUREMENTS);
+    fprintf(stderr, "  -j  Print a JSON summary line at the end\n");
+    fprintf(stderr, "  -a  Adapt the bit delay to the observed error rate (%d-%d us)\n",
+            ADAPTIVE_MIN_BIT_DELAY_US, ADAPTIVE_MAX_BIT_DELAY_US);
+    fprintf(stderr, "  -i  Wait for the data-ready interrupt (GPIO1) on GPIO%d (+ sensor)\n", INT_PIN);
+    fprintf(stderr, "      instead of sleeping a measurement period\n");
+    fprintf(stderr, "  -C  Continuous (timed) ranging at the measurement frequency: one\n");
+    fprintf(stderr, "      read per sample instead of start, status and result\n");
+    fprintf(stderr, "  -N  Sensors per bus, 1-%d (default: 1). They are re-addressed to\n",
+            VL53L0X_MAX_SENSORS);
+    fprintf(stderr, "      0x%02X + n through XSHUT and measured in turn\n", VL53L0X_ARRAY_ADDR);
+    fprintf(stderr, "  -X  XSHUT of sensor n on GPIO<pin + n> (default with -N: %d)\n", XSHUT_PIN);
+    fprintf(stderr, "  -v  Log level: %d errors, %d measurement cycles, %d debug (default: %d)\n",
+            I2C_LOG_ERROR, I2C_LOG_INFO, I2C_LOG_DEBUG, I2C_LOG_INFO);
+    fprintf(stderr, "  -T  Record SDA/SCL and dump the last ms milliseconds before each\n");
+    fprintf(stderr, "      failed transaction to i2c_vl53l0x_master_<pid>_<n>.vcd\n");
+    fprintf(stderr, "      (_bus<b>_ with -B)\n");
+    fprintf(stderr, "  -r  Real-time profile: SCHED_FIFO, locked memory, CPU affinity and\n");
+    fprintf(stderr, "      minimal timer slack; warn about what cannot be obtained\n");
+    fprintf(stderr, "  -R  Like -r, but fail if any of it cannot be obtained\n");
+    fprintf(stderr, "  -p  SCHED_FIFO priority (default: %d)\n", I2C_RT_DEFAULT_PRIORITY);
+    fprintf(stderr, "  -c  CPU to run on, bus n on CPU + n (default: isolcpus cores, if any)\n");
+}
+
+int main(int argc, char *argv[]) {
+    I2C_Config defaults;
+    int log_level = I2C_LOG_INFO;
+    int bit_delay = I2C_BIT_DELAY_US;
+    int json = 0;
+    int started = 0;
+    int result = 0;
+    
+    signal(SIGINT, handle_signal);
+    
+    memset(&defaults, 0, sizeof(defaults));
+    i2c_rt_defaults(&rt);
+    for (int b = 0; b < VL53L0X_MAX_BUSES; b++) {
+        bus_configs[b] = &buses[b].config;
+    }
+    buses[0].config.sda_pin = SDA_PIN;
+    buses[0].config.scl_pin = SCL_PIN;
+    
+    int opt;
+    while ((opt = getopt(argc, argv, "b:d:B:W:t:f:n:jaiCN:X:v:T:rRp:c:h")) != -1) {
+        switch (opt) {
+        case 'b':
+            if (i2c_set_backend(&defaults, optarg) < 0) {
+                return 1;
+            }
+            break;
+        case 'd':
+            defaults.device = optarg;
+            break;
+        case 'B':
+            if ((bus_count = i2c_parse_buses(optarg, bus_configs, VL53L0X_MAX_BUSES)) < 0) {
+                return 1;
+            }
+            break;
+        case 'W':
+            if ((wide_count = i2c_parse_wide(optarg, wide_pins)) < 0) {
+                return 1;
+            }
+            break;
+        case 't':
+            bit_delay = atoi(optarg);
+            break;
+        case 'f':
+            measurement_frequency_hz = atoi(optarg);
+            break;
+        case 'n':
+            max_measurements = atoi(optarg);
+            break;
+        case 'j':
+            json = 1;
+            break;
+        case 'a':
+            adaptive = 1;
+            break;
+        case 'i':
+            interrupt = 1;
+            break;
+        case 'C':
+            continuous = 1;
+            break;
+        case 'N':
+            sensor_count = atoi(optarg);
+            break;
+        case 'X':
+            xshut_pin = atoi(optarg);
+            break;
+        case 'v':
+            log_level = atoi(optarg);
+            break;
+        case 'T':
+            trace_window_ms = atoi(optarg);
+            break;
+        case 'r':
+        case 'R':
+            rt.enabled = 1;
+            rt.required |= opt == 'R';
+            break;
+        case 'p':
+            rt.priority = atoi(optarg);
+            break;
+        case 'c':
+            rt.cpu = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    
+    if (bit_delay <= 0 || measurement_frequency_hz <= 0 || max_measurements <= 0) {
+        fprintf(stderr, "Bit delay, frequency and cycles must be positive\n");
+        return 1;
+    }
+    if (sensor_count < 1 || sensor_count > VL53L0X_MAX_SENSORS) {
+        fprintf(stderr, "Sensors must be 1-%d\n", VL53L0X_MAX_SENSORS);
+        return 1;
+    }
+    if (wide_count > 0 && (bus_count > 1 || sensor_count > 1 || xshut_pin >= 0 || interrupt)) {
+        fprintf(stderr, "A wide bus (-W) cannot be combined with -B, -N, -X or -i\n");
+        return 1;
+    }
+    if (sensor_count > 1 && xshut_pin < 0) {
+        xshut_pin = XSHUT_PIN;
+    }
+    measurement_delay_us = 1000000 / measurement_frequency_hz;
+    
+    // All sensors of a wide bus answer at VL53L0X_ADDR on SDA lines of their own
+    if (wide_count > 0) {
+        buses[0].config.width = wide_count;
+        memcpy(buses[0].config.sda_pins, wide_pins, sizeof(wide_pins));
     }
     
-    printf("\n=== Test Results ===\n");
-    printf("Test frequency: %d Hz\n", MEASUREMENT_FREQUENCY_HZ);
-    printf("Actual iterations: %d\n", cycle);
-    printf("Successful: %d\n", successful_measurements);
-    printf("Success rate: %.1f%%\n", (successful_measurements * 100.0) / cycle);
+    // Configure I2C: the same settings on every bus, only the pins differ
+    for (int b = 0; b < bus_count; b++) {
+        MasterBus *bus = &buses[b];
+        I2C_Config *config = &bus->config;
+        
+        bus->index = b;
+        config->ops = defaults.ops;
+        config->device = defaults.device;
+        config->slave_address = VL53L0X_ADDR;
+        config->bit_delay = bit_delay;
+        if (bus_count > 1) {
+            snprintf(bus->trace_prefix, sizeof(bus->trace_prefix), "i2c_vl53l0x_master_bus%d", b);
+            snprintf(bus->log_prefix, sizeof(bus->log_prefix), "[bus %d] ", b);
+        } else {
+            snprintf(bus->trace_prefix, sizeof(bus->trace_prefix), "i2c_vl53l0x_master");
+        }
+    }
+    
+    // Sensor n of bus b has the aux lines of sensor b * sensor_count + n,
+    // none of which may land on a bus line
+    int lines = bus_count * sensor_count;
+    if ((xshut_pin >= 0 && i2c_check_aux_pins(bus_configs, bus_count, xshut_pin, lines, "XSHUT") < 0) ||
+        (interrupt && i2c_check_aux_pins(bus_configs, bus_count, INT_PIN, lines, "INT") < 0)) {
+        return 1;
+    }
+    
+    printf("VL53L0X Master Test Program\n");
+    
+    // A single bus is driven by the main thread
+    if (bus_count == 1) {
+        MasterBus *bus = &buses[0];
+        
+        if (bus_start(bus) < 0) {
+            return 1;
+        }
+        
+        // From here on the measurement loop only queues its messages
+        i2c_log_start(log_level);
+        loop_start = i2c_now_ns();
+        bus_measure(bus);
+        i2c_log_stop();
+        
+        bus_report(bus, json);
+        i2c_latency_free(&bus->latency);
+        
+        printf("\nCleaning up...\n");
+        i2c_cleanup(&bus->config);
+        i2c_trace_free(&bus->trace);
+        return 0;
+    }
+    
+    // Bring the buses up one after the other, so their setup output does
+    // not interleave, then let all of them go at once
+    for (started = 0; started < bus_count; started++) {
+        MasterBus *bus = &buses[started];
+        
+        printf("\n");
+        sem_init(&bus->ready, 0, 0);
+        sem_init(&bus->go, 0, 0);
+        if (pthread_create(&bus->thread, NULL, bus_thread, bus) != 0) {
+            fprintf(stderr, "Failed to start worker for bus %d\n", started);
+            result = -1;
+            break;
+        }
+        sem_wait(&bus->ready);
+        if (bus->status < 0) {
+            pthread_join(bus->thread, NULL);
+            result = -1;
+            break;
+        }
+    }
+    if (result < 0) {
+        running = 0;
+    } else {
+        printf("\n=== Starting Distance Measurements ===\n");
+        printf("Buses: %d, Frequency: %d Hz, Period: %d ms\n", bus_count, measurement_frequency_hz,
+               measurement_delay_us/1000);
+    }
+    
+    // From here on the workers only queue their messages
+    i2c_log_start(log_level);
+    loop_start = i2c_now_ns();
+    for (int b = 0; b < started; b++) {
+        sem_post(&buses[b].go);
+    }
+    for (int b = 0; b < started; b++) {
+        pthread_join(buses[b].thread, NULL);
+    }
+    i2c_log_stop();
+    
+    // Every bus, then all of them together
+    if (result == 0) {
+        I2C_Latency total;
+        int cycles = 0, successful = 0;
+        int common_delay = buses[0].config.bit_delay;  // -1 once buses ended at different delays (-a)
+        double elapsed_s = 0;
+        
+        i2c_latency_init(&total);
+        for (int b = 0; b < bus_count; b++) {
+            MasterBus *bus = &buses[b];
+            bus_report(bus, json);
+            cycles += bus->cycles;
+            successful += bus->successful;
+            if (bus->config.bit_delay != common_delay) {
+                common_delay = -1;
+            }
+            if (bus->elapsed_s > elapsed_s) {
+                elapsed_s = bus->elapsed_s;
+            }
+            for (size_t i = 0; i < bus->latency.count; i++) {
+                i2c_latency_add(&total, bus->latency.ns[i]);
+            }
+        }
+        
+        printf("\n=== Total ===\n");
+        printf("Buses: %d, iterations: %d, successful: %d (%.1f%%)\n", bus_count, cycles, successful,
+               cycles ? (successful * 100.0) / cycles : 0.0);
+        printf("Throughput: %.1f measurements/s over %.2f s\n", elapsed_s > 0 ? successful / elapsed_s : 0.0,
+               elapsed_s);
+        if (json) {
+            print_json_summary("", common_delay, cycles, successful, elapsed_s, &total);
+        }
+        i2c_latency_free(&total);
+    }
     
     printf("\nCleaning up...\n");
-    i2c_cleanup(&config);
+    for (int b = 0; b < started; b++) {
+        i2c_latency_free(&buses[b].latency);
+        i2c_cleanup(&buses[b].config);
+        i2c_trace_free(&buses[b].trace);
+    }
     
-    return 0;
-}
\ No newline at end of file
+    return result < 0 ? 1 : 0;
+}
@@ -1,5 +1,6 @@
 // soft_i2c_fixed.c - Fixed software I2C implementation
 #include "soft_i2c.h"
+#include "i2c_log.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -16,192 +17,330 @@
 #define I2C_STABILIZATION_DIV   4       // Divisor for stabilization delay
 #define I2C_SMALL_DELAY_DIV     10      // Divisor for small delays
 #define I2C_ACTIVITY_TIMEOUT    10000   // Timeout for activity detection
-#define I2C_ACK_ATTEMPTS        5       // Number of ACK read attempts
-#define I2C_ACK_TIMEOUT         100     // Timeout for ACK operations
+#define I2C_STRETCH_TIMEOUT_US  25000   // Default clock stretch limit (SMBus tTIMEOUT)
+#define I2C_EDGE_BATCH          64      // Edges read from the backend per poll
+#define I2C_DECODER_TIMEOUT_NS  100000000ULL  // Abandon a transfer after 100ms without edges
 
-// Proper implementation of mode switching for SDA
-static int sda_set_mode(I2C_Config *config, int mode) {
-    gpiod_line_release(config->sda_line);
-    
-    if (mode == 0) {
-        // Output mode
-        if (gpiod_line_request_output(config->sda_line, "i2c_sda_out", 1) < 0) {
-            fprintf(stderr, "Failed to set SDA as output: %s\n", strerror(errno));
-            return -1;
-        }
-    } else {
-        // Input mode
-        if (gpiod_line_request_input(config->sda_line, "i2c_sda_in") < 0) {
-            fprintf(stderr, "Failed to set SDA as input: %s\n", strerror(errno));
-            return -1;
-        }
+// Master bit delays per START, STOP, written byte (8 bits of 3 plus ACK of
+// 2) and read byte (8 bits of 2 plus ACK of 2)
+#define I2C_START_DELAYS        3
+#define I2C_STOP_DELAYS         3
+#define I2C_WRITE_DELAYS        26
+#define I2C_READ_DELAYS         18
+
+// Event-driven slave decoder states
+#define I2C_DEC_IDLE            0       // Waiting for START
+#define I2C_DEC_ADDRESS         1       // Receiving the address byte
+#define I2C_DEC_ADDR_ACK        2       // Driving ACK for our address
+#define I2C_DEC_WRITE           3       // Receiving a data byte
+#define I2C_DEC_WRITE_ACK       4       // Driving ACK for a data byte
+#define I2C_DEC_READ            5       // Driving a data byte
+#define I2C_DEC_READ_ACK        6       // Master's ACK/NACK slot
+#define I2C_DEC_IGNORE          7       // Not addressed or NACKed, waiting for START/STOP
+
+// Backends selectable by name; the first one is the default
+static const I2C_LineOps *const i2c_backends[] = {
+#ifndef I2C_NO_GPIOD
+    &i2c_gpiod_ops,
+#endif
+    &i2c_mmio_ops,
+    &i2c_sim_ops,
+};
+
+// Record the line state in the flight recorder, if enabled. ts_ns is the
+// time of the sample (0 = now).
+static inline void trace_lines(I2C_Config *config, uint64_t ts_ns, int sda, int scl) {
+    if (config->trace) {
+        i2c_trace_record(config->trace, ts_ns, sda, scl, config->sda_out, config->scl_out);
     }
-    return 0;
 }
 
-// SCL mode switching not needed - master always controls SCL
-// static int scl_set_mode(I2C_Config *config, int mode) {
-//     gpiod_line_release(config->scl_line);
-//     
-//     if (mode == 0) {
-//         // Output mode
-//         if (gpiod_line_request_output(config->scl_line, "i2c_scl_out", 1) < 0) {
-//             fprintf(stderr, "Failed to set SCL as output: %s\n", strerror(errno));
-//             return -1;
-//         }
-//     } else {
-//         // Input mode
-//         if (gpiod_line_request_input(config->scl_line, "i2c_scl_in") < 0) {
-//             fprintf(stderr, "Failed to set SCL as input: %s\n", strerror(errno));
-//             return -1;
-//         }
-//     }
-//     return 0;
-// }
-
-// Initialize GPIO using libgpiod
-int i2c_init(I2C_Config *config) {
-    // Open GPIO chip
-    config->chip = gpiod_chip_open_by_name("gpiochip0");
-    if (!config->chip) {
-        config->chip = gpiod_chip_open_by_name("gpiochip1");
-        if (!config->chip) {
-            fprintf(stderr, "Failed to open GPIO chip\n");
-            return -1;
+// Record a change of the level we drive on one line. Until the next
+// sample that line is assumed to follow: low when pulled low, at the
+// pull-up when released.
+static inline void trace_drive(I2C_Config *config, int sda, int scl) {
+    if (config->trace) {
+        trace_lines(config, 0, sda < 0 ? config->trace->last.sda : sda,
+                    scl < 0 ? config->trace->last.scl : scl);
+    }
+}
+
+// SDA lines of the bus as a mask, bit n = line n
+static inline uint32_t all_lines(const I2C_Config *config) {
+    return config->width > 1 ? (1u << config->width) - 1 : 1;
+}
+
+// Record the SDA direction, letting backends that need it switch the line
+static void sda_set_dir(I2C_Config *config, int dir) {
+    if (config->ops->set_sda_dir) {
+        config->ops->set_sda_dir(config, dir);
+    }
+    config->sda_dir = dir;
+}
+
+// Wide bus: drive every SDA line to its bit of levels in one request
+static void sda_write_lines(I2C_Config *config, uint32_t levels) {
+    if (config->sda_lines_out != levels) {
+        config->ops->set_sda_lines(config, levels);
+        config->sda_lines_out = levels;
+        config->sda_out = levels == all_lines(config);
+        trace_drive(config, config->sda_out, -1);
+    }
+}
+
+// Drive SDA low (0) or release it (1), on every line of a wide bus.
+// Levels are cached so writes that would not change the line (repeated
+// bits, releasing a released line) never reach the backend.
+static void sda_write(I2C_Config *config, int value) {
+    if (config->width > 1) {
+        sda_write_lines(config, value ? all_lines(config) : 0);
+    } else if (config->sda_out != value) {
+        if (value == 0 && config->sda_dir != I2C_DIR_OUT) {
+            sda_set_dir(config, I2C_DIR_OUT);
         }
+        config->ops->set_sda(config, value);
+        config->sda_out = value;
+        trace_drive(config, value, -1);
     }
-    
-    // Get GPIO lines
-    config->sda_line = gpiod_chip_get_line(config->chip, config->sda_pin);
-    config->scl_line = gpiod_chip_get_line(config->chip, config->scl_pin);
-    
-    if (!config->sda_line || !config->scl_line) {
-        fprintf(stderr, "Failed to get GPIO lines\n");
-        gpiod_chip_close(config->chip);
-        return -1;
+}
+
+// Release SDA and hand it to the other side
+static void sda_release(I2C_Config *config) {
+    sda_write(config, 1);
+    if (config->sda_dir != I2C_DIR_IN) {
+        sda_set_dir(config, I2C_DIR_IN);
     }
-    
-    // Configure pins as outputs initially
-    if (gpiod_line_request_output(config->sda_line, "i2c_sda", 1) < 0) {
-        fprintf(stderr, "Failed to configure SDA line as output: %s\n", strerror(errno));
-        gpiod_chip_close(config->chip);
+}
+
+// Drive SCL low (0) or release it (1)
+static void scl_write(I2C_Config *config, int value) {
+    if (config->scl_out != value) {
+        config->ops->set_scl(config, value);
+        config->scl_out = value;
+        trace_drive(config, -1, value);
+    }
+}
+
+// Sample SDA and SCL at the same instant. On a wide bus SDA reads high
+// only when every line does.
+static int lines_read(I2C_Config *config, int *sda, int *scl) {
+    int result;
+    
+    if (config->width > 1) {
+        result = config->ops->read_sda_lines(config, &config->sda_lines_in, scl);
+        *sda = config->sda_lines_in == all_lines(config);
+    } else {
+        result = config->ops->read_lines(config, sda, scl);
+    }
+    if (result == 0) {
+        config->sda_in = *sda;
+        config->scl_in = *scl;
+        trace_lines(config, 0, *sda, *scl);
+    }
+    return result;
+}
+
+static int sda_read(I2C_Config *config) {
+    int sda, scl;
+    if (lines_read(config, &sda, &scl) < 0) {
         return -1;
     }
-    
-    if (gpiod_line_request_output(config->scl_line, "i2c_scl", 1) < 0) {
-        fprintf(stderr, "Failed to configure SCL line as output: %s\n", strerror(errno));
-        gpiod_chip_close(config->chip);
+    return sda;
+}
+
+// SDA of every line, bit n = line n; all high (released) on error
+static uint32_t sda_read_lines(I2C_Config *config) {
+    int sda, scl;
+    if (lines_read(config, &sda, &scl) < 0) {
+        return all_lines(config);
+    }
+    return config->width > 1 ? config->sda_lines_in : (uint32_t)sda;
+}
+
+static int scl_read(I2C_Config *config) {
+    int sda, scl;
+    if (lines_read(config, &sda, &scl) < 0) {
         return -1;
     }
-    
-    // Default bit delay if not specified  
-    if (config->bit_delay == 0) {
-        config->bit_delay = 2000;  // 2000 microseconds
+    return scl;
+}
+
+static void line_delay(I2C_Config *config, int us) {
+    config->ops->delay(config, us);
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Master: release SCL and wait until it really reads high, as a slave may
+// hold it low (clock stretching) while it prepares data. Returns -1 if it
+// is still held after the stretch timeout.
+static int scl_release_wait(I2C_Config *config) {
+    scl_write(config, 1);
+    if (scl_read(config) == 1) {
+        return 0;
     }
     
-    printf("GPIO initialized: SDA=GPIO%d, SCL=GPIO%d, bit_delay=%dus\n", 
-           config->sda_pin, config->scl_pin, config->bit_delay);
-    
+    int timeout_us = config->stretch_timeout_us ? config->stretch_timeout_us : I2C_STRETCH_TIMEOUT_US;
+    uint64_t deadline = monotonic_ns() + (uint64_t)timeout_us * 1000;
+    while (scl_read(config) != 1) {
+        if (monotonic_ns() > deadline) {
+            config->stretch_timeouts++;
+            return -1;
+        }
+        line_delay(config, 1);
+    }
+    config->stretches++;
     return 0;
 }
 
-// Initialize I2C for slave (input mode for reading)
-int i2c_init_slave(I2C_Config *config) {
-    config->chip = gpiod_chip_open("/dev/gpiochip0");
-    if (!config->chip) {
-        fprintf(stderr, "Failed to open GPIO chip: %s\n", strerror(errno));
-        return -1;
+// Slave: hold SCL low after the master pulled it low, so the master
+// waits until we are ready for the next bit
+static void scl_hold(I2C_Config *config) {
+    if (config->clock_stretch) {
+        scl_write(config, 0);
+    }
+}
+
+// Open the backend with both lines released
+static int open_lines(I2C_Config *config, const char *consumer) {
+    if (!config->ops) {
+        config->ops = i2c_backends[0];
     }
     
-    config->sda_line = gpiod_chip_get_line(config->chip, config->sda_pin);
-    config->scl_line = gpiod_chip_get_line(config->chip, config->scl_pin);
+    // Default bit delay if not specified  
+    if (config->bit_delay == 0) {
+        config->bit_delay = 2000;  // 2000 microseconds
+    }
     
-    if (!config->sda_line || !config->scl_line) {
-        fprintf(stderr, "Failed to get GPIO lines\n");
-        gpiod_chip_close(config->chip);
-        return -1;
+    if (!config->timing.calibrated) {
+        i2c_delay_calibrate(&config->timing);
     }
     
-    // Configure pins as inputs for slave
-    if (gpiod_line_request_input(config->sda_line, "i2c_sda_slave") < 0) {
-        fprintf(stderr, "Failed to configure SDA line as input: %s\n", strerror(errno));
-        gpiod_chip_close(config->chip);
-        return -1;
+    if (config->width > 1) {
+        if (config->width > I2C_WIDE_MAX) {
+            fprintf(stderr, "A wide bus has at most %d SDA lines\n", I2C_WIDE_MAX);
+            return -1;
+        }
+        if (!config->ops->set_sda_lines || !config->ops->read_sda_lines || config->edge_events) {
+            fprintf(stderr, "Backend %s has no wide bus%s\n", config->ops->name,
+                    config->edge_events ? " with edge events" : "");
+            return -1;
+        }
+        config->sda_pin = config->sda_pins[0];
     }
     
-    if (gpiod_line_request_input(config->scl_line, "i2c_scl_slave") < 0) {
-        fprintf(stderr, "Failed to configure SCL line as input: %s\n", strerror(errno));
-        gpiod_chip_close(config->chip);
+    if (config->ops->open(config, consumer) < 0) {
         return -1;
     }
-    
-    if (config->bit_delay == 0) {
-        config->bit_delay = 2000;
+    config->sda_lines_out = all_lines(config);
+    config->sda_out = 1;
+    config->scl_out = 1;
+    config->sda_dir = I2C_DIR_IN;
+    return 0;
+}
+
+// List the SDA lines of a wide bus
+static void print_wide(const I2C_Config *config) {
+    if (config->width > 1) {
+        printf("Wide bus: %d SDA lines on GPIO%d", config->width, config->sda_pins[0]);
+        for (int n = 1; n < config->width; n++) {
+            printf(", GPIO%d", config->sda_pins[n]);
+        }
+        printf("\n");
+    }
+}
+
+// Initialize the lines for master use
+int i2c_init(I2C_Config *config) {
+    if (open_lines(config, "i2c_master") < 0) {
+        return -1;
     }
     
-    printf("GPIO initialized for slave: SDA=GPIO%d, SCL=GPIO%d, bit_delay=%dus\n", 
-           config->sda_pin, config->scl_pin, config->bit_delay);
+    printf("GPIO initialized (%s): SDA=GPIO%d, SCL=GPIO%d, bit_delay=%dus\n", 
+           config->ops->name, config->sda_pin, config->scl_pin, config->bit_delay);
+    print_wide(config);
     
     return 0;
 }
 
-// Helper function for slave to send ACK/NACK
-int i2c_slave_send_ack(I2C_Config *config, int ack) {
-    // Reconfigure SDA as output to send ACK
-    if (sda_set_mode(config, 0) < 0) {
+// Initialize I2C for slave (both lines released, listening)
+int i2c_init_slave(I2C_Config *config) {
+    if (open_lines(config, "i2c_slave") < 0) {
         return -1;
     }
     
-    gpiod_line_set_value(config->sda_line, ack ? 1 : 0);
+    printf("GPIO initialized for slave (%s): SDA=GPIO%d, SCL=GPIO%d, bit_delay=%dus\n", 
+           config->ops->name, config->sda_pin, config->scl_pin, config->bit_delay);
+    print_wide(config);
+    
+    return 0;
+}
+
+// Send ACK/NACK, optionally stretching the clock afterwards. The hold is
+// taken as soon as the master pulls SCL low, before SDA is released.
+static int slave_ack(I2C_Config *config, int ack, int hold) {
+    // Pull SDA low for ACK (or leave it released for NACK)
+    sda_write(config, ack ? 1 : 0);
     
     // Wait for master to bring SCL high
     int timeout = 0;
-    while (gpiod_line_get_value(config->scl_line) == 0 && timeout < I2C_WAIT_CYCLES) {
-        usleep(config->bit_delay / I2C_SMALL_DELAY_DIV);
+    while (scl_read(config) == 0 && timeout < I2C_WAIT_CYCLES) {
+        line_delay(config, config->bit_delay / I2C_SMALL_DELAY_DIV);
         timeout++;
     }
     
     // Wait for master to bring SCL low
     timeout = 0;
-    while (gpiod_line_get_value(config->scl_line) == 1 && timeout < I2C_WAIT_CYCLES) {
-        usleep(config->bit_delay / I2C_SMALL_DELAY_DIV);
+    while (scl_read(config) == 1 && timeout < I2C_WAIT_CYCLES) {
+        line_delay(config, config->bit_delay / I2C_SMALL_DELAY_DIV);
         timeout++;
     }
     
-    // Release SDA and reconfigure back as input
-    if (sda_set_mode(config, 1) < 0) {
-        return -1;
+    if (hold) {
+        scl_hold(config);
     }
     
+    // Release SDA
+    sda_release(config);
+    
     return 0;
 }
 
+// Helper function for slave to send ACK/NACK
+int i2c_slave_send_ack(I2C_Config *config, int ack) {
+    return slave_ack(config, ack, 0);
+}
+
 void i2c_cleanup(I2C_Config *config) {
-    if (config->sda_line) {
-        gpiod_line_release(config->sda_line);
-    }
-    if (config->scl_line) {
-        gpiod_line_release(config->scl_line);
+    if (config->ops && config->line_priv) {
+        config->ops->close(config);
     }
-    if (config->chip) {
-        gpiod_chip_close(config->chip);
+    i2c_delay_report(&config->timing);
+    if (config->trace) {
+        printf("Trace: %lu failures, %d dumped\n", config->trace->failures, config->trace->dumps);
     }
 }
 
 // Generate I2C start condition
 int i2c_start(I2C_Config *config) {
     // Ensure both lines are high initially
-    gpiod_line_set_value(config->sda_line, 1);
-    gpiod_line_set_value(config->scl_line, 1);
-    usleep(config->bit_delay);
+    sda_write(config, 1);
+    if (scl_release_wait(config) < 0) {
+        return -1;
+    }
+    line_delay(config, config->bit_delay);
     
     // START: SDA goes low while SCL is high
-    gpiod_line_set_value(config->sda_line, 0);
-    usleep(config->bit_delay);
+    sda_write(config, 0);
+    line_delay(config, config->bit_delay);
     
     // Then bring SCL low
-    gpiod_line_set_value(config->scl_line, 0);
-    usleep(config->bit_delay);
+    scl_write(config, 0);
+    line_delay(config, config->bit_delay);
     
     return 0;
 }
@@ -209,99 +348,125 @@ int i2c_start(I2C_Config *config) {
 // Generate I2C stop condition
 void i2c_stop(I2C_Config *config) {
     // Ensure SDA is low and SCL is low
-    gpiod_line_set_value(config->sda_line, 0);
-    gpiod_line_set_value(config->scl_line, 0);
-    usleep(config->bit_delay);
+    sda_write(config, 0);
+    scl_write(config, 0);
+    line_delay(config, config->bit_delay);
     
     // Bring SCL high first
-    gpiod_line_set_value(config->scl_line, 1);
-    usleep(config->bit_delay);
+    scl_release_wait(config);
+    line_delay(config, config->bit_delay);
     
     // STOP: SDA goes high while SCL is high
-    gpiod_line_set_value(config->sda_line, 1);
-    usleep(config->bit_delay);
+    sda_write(config, 1);
+    line_delay(config, config->bit_delay);
 }
 
 // Write a byte to I2C bus
 int i2c_write_byte(I2C_Config *config, uint8_t byte) {
     int i;
     
-    // Make sure SDA is in output mode
-    if (sda_set_mode(config, 0) < 0) {
-        return -1;
-    }
-    
     // Send 8 bits, MSB first
     for (i = 7; i >= 0; i--) {
         int bit = (byte >> i) & 1;
-        gpiod_line_set_value(config->sda_line, bit);
-        usleep(config->bit_delay);
+        sda_write(config, bit);
+        line_delay(config, config->bit_delay);
         
-        gpiod_line_set_value(config->scl_line, 1);
-        usleep(config->bit_delay);
+        if (scl_release_wait(config) < 0) {
+            return -1;
+        }
+        line_delay(config, config->bit_delay);
         
-        gpiod_line_set_value(config->scl_line, 0);
-        usleep(config->bit_delay);
+        scl_write(config, 0);
+        line_delay(config, config->bit_delay);
     }
     
-    // Switch to input mode to read ACK
-    if (sda_set_mode(config, 1) < 0) {
-        return -1;
-    }
+    // Release SDA so the slave can drive ACK
+    sda_release(config);
     
     // Clock ACK bit
-    gpiod_line_set_value(config->scl_line, 1);
-    usleep(config->bit_delay);
-    
-    int ack = gpiod_line_get_value(config->sda_line);
-    
-    gpiod_line_set_value(config->scl_line, 0);
-    usleep(config->bit_delay);
-    
-    // Switch back to output mode
-    if (sda_set_mode(config, 0) < 0) {
+    if (scl_release_wait(config) < 0) {
         return -1;
     }
+    line_delay(config, config->bit_delay);
+    
+    config->nacked = sda_read_lines(config);
+    
+    scl_write(config, 0);
+    line_delay(config, config->bit_delay);
     
-    return ack ? -1 : 0;  // Return 0 on ACK, -1 on NACK
+    return config->nacked ? -1 : 0;  // Return 0 on ACK, -1 on NACK (by any line)
 }
 
-// Read a byte from I2C bus
-uint8_t i2c_read_byte(I2C_Config *config, int ack) {
-    int i;
-    uint8_t byte = 0;
+// Transpose an 8x8 bit matrix: byte i of x is the sample of bit i (bit n
+// of it = line n), byte n of the result is line n's byte
+static uint64_t transpose8(uint64_t x) {
+    uint64_t t;
+    
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x ^= t ^ (t << 28);
+    return x;
+}
+
+// Read a byte from every SDA line. Each bit is one bulk sample of all
+// lines; the samples are de-interleaved into bytes afterwards, so the
+// per-bit cost does not grow with the number of lines.
+int i2c_read_byte_wide(I2C_Config *config, int ack, uint8_t *bytes) {
+    uint64_t samples = 0;
+    int i, result = 0;
     
-    // Switch SDA to input mode
-    if (sda_set_mode(config, 1) < 0) {
-        return 0xFF;
-    }
+    // Release SDA so the slave can drive data
+    sda_release(config);
     
     // Read 8 bits
     for (i = 7; i >= 0; i--) {
-        gpiod_line_set_value(config->scl_line, 1);
-        usleep(config->bit_delay);
-        
-        if (gpiod_line_get_value(config->sda_line)) {
-            byte |= (1 << i);
+        if (scl_release_wait(config) < 0) {
+            scl_write(config, 0);
+            result = -1;
+            break;
         }
+        line_delay(config, config->bit_delay);
         
-        gpiod_line_set_value(config->scl_line, 0);
-        usleep(config->bit_delay);
+        samples = (samples << 8) | sda_read_lines(config);
+        
+        scl_write(config, 0);
+        line_delay(config, config->bit_delay);
     }
     
-    // Switch to output mode to send ACK/NACK
-    if (sda_set_mode(config, 0) < 0) {
-        return byte;
+    // Bits not clocked in read as 0
+    for (; i >= 0; i--) {
+        samples <<= 8;
+    }
+    samples = transpose8(samples);
+    for (int n = 0; n < (config->width > 1 ? config->width : 1); n++) {
+        bytes[n] = samples >> (8 * n);
+    }
+    if (result < 0) {
+        return -1;
     }
     
-    gpiod_line_set_value(config->sda_line, ack ? 1 : 0);
+    // Send ACK/NACK
+    sda_write(config, ack ? 1 : 0);
     
-    gpiod_line_set_value(config->scl_line, 1);
-    usleep(config->bit_delay);
-    gpiod_line_set_value(config->scl_line, 0);
-    usleep(config->bit_delay);
+    scl_release_wait(config);
+    line_delay(config, config->bit_delay);
+    scl_write(config, 0);
+    line_delay(config, config->bit_delay);
     
-    return byte;
+    return 0;
+}
+
+// Read a byte from I2C bus, line 0's on a wide bus. A clock stretch
+// timeout is counted in config->stretch_timeouts; the byte is then not
+// valid.
+uint8_t i2c_read_byte(I2C_Config *config, int ack) {
+    uint8_t bytes[I2C_WIDE_MAX];
+    
+    i2c_read_byte_wide(config, ack, bytes);
+    return bytes[0];
 }
 
 // Get current timestamp in milliseconds
@@ -312,58 +477,61 @@ uint64_t get_timestamp_ms(void) {
 }
 
 // Slave listens for its address
+static int slave_address(I2C_Config *config);
+
 int i2c_slave_listen(I2C_Config *config) {
-    int i;
-    uint8_t address = 0;
-    int read_write_bit;
-    
-    // Wait for bus activity - simplified approach
-    int activity_detected = 0;
+    // The bus is known idle if it was at our last sample, i.e. after the
+    // STOP that ended the previous transfer, so a START the master sends
+    // right behind it is recognized from the first sample on
+    int idle = config->sda_in == 1 && config->scl_in == 1;
+    int moved = 0;
     int timeout_count = 0;
     
-    // First, wait for bus to be idle (both lines high)
     while (timeout_count < I2C_ACTIVITY_TIMEOUT) {
-        int sda_val = gpiod_line_get_value(config->sda_line);
-        int scl_val = gpiod_line_get_value(config->scl_line);
-        
-        if (sda_val == 1 && scl_val == 1) {
-            // Bus is idle, now wait for activity
-            break;
+        int sda_val, scl_val;
+        if (lines_read(config, &sda_val, &scl_val) < 0) {
+            return -1;
         }
         
-        usleep(config->bit_delay / I2C_STABILIZATION_DIV);
-        timeout_count++;
-    }
-    
-    // Now wait for START condition
-    timeout_count = 0;
-    while (!activity_detected && timeout_count < I2C_ACTIVITY_TIMEOUT) {
-        int sda_val = gpiod_line_get_value(config->sda_line);
-        int scl_val = gpiod_line_get_value(config->scl_line);
-        
-        // Any activity on the bus
-        if (sda_val == 0 || scl_val == 0) {
-            activity_detected = 1;
-            break;
+        // START: SDA falls while SCL stays high on an idle bus
+        if (idle && sda_val == 0 && scl_val == 1) {
+            return slave_address(config);
         }
         
-        usleep(config->bit_delay / I2C_STABILIZATION_DIV);
+        // Both high is an idle bus, or the high phase of a 1 bit if we
+        // came in mid-transfer. Then SCL falls first and we wait on for a
+        // STOP, rather than sample the rest of the byte misaligned.
+        idle = sda_val == 1 && scl_val == 1;
+        moved |= !idle;
+        
+        line_delay(config, config->bit_delay / I2C_STABILIZATION_DIV);
         timeout_count++;
     }
     
-    if (!activity_detected) {
-        return -1;
-    }
+    return moved ? I2C_SLAVE_LOST : -1;
+}
+
+// Receive the address byte after a (repeated) START and ACK it if it is
+// ours. Returns the R/W bit, or -1.
+static int slave_address(I2C_Config *config) {
+    int i;
+    uint8_t address = 0;
+    int read_write_bit;
     
-    // Wait for clock to stabilize
-    usleep(config->bit_delay);
+    // Wait for the master to finish START by pulling SCL low, so the
+    // address sampling below never mistakes the START itself for a bit
+    int timeout = 0;
+    while (scl_read(config) == 1 && timeout < I2C_WAIT_CYCLES) {
+        line_delay(config, config->bit_delay / I2C_SMALL_DELAY_DIV);
+        timeout++;
+    }
     
     // Read address byte
     for (i = 7; i >= 0; i--) {
         // Wait for SCL high
-        int timeout = 0;
-        while (gpiod_line_get_value(config->scl_line) == 0 && timeout < I2C_WAIT_CYCLES) {
-            usleep(config->bit_delay / I2C_SMALL_DELAY_DIV);
+        timeout = 0;
+        while (scl_read(config) == 0 && timeout < I2C_WAIT_CYCLES) {
+            line_delay(config, config->bit_delay / I2C_SMALL_DELAY_DIV);
             timeout++;
         }
         
@@ -372,14 +540,14 @@ int i2c_slave_listen(I2C_Config *config) {
         }
         
         // Read bit
-        if (gpiod_line_get_value(config->sda_line)) {
+        if (sda_read(config)) {
             address |= (1 << i);
         }
         
         // Wait for SCL low
         timeout = 0;
-        while (gpiod_line_get_value(config->scl_line) == 1 && timeout < I2C_WAIT_CYCLES) {
-            usleep(config->bit_delay / I2C_SMALL_DELAY_DIV);
+        while (scl_read(config) == 1 && timeout < I2C_WAIT_CYCLES) {
+            line_delay(config, config->bit_delay / I2C_SMALL_DELAY_DIV);
             timeout++;
         }
     }
@@ -387,44 +555,76 @@ int i2c_slave_listen(I2C_Config *config) {
     read_write_bit = address & 0x01;
     address >>= 1;
     
-    if (address != config->slave_address) {
+    int match = config->address_map ? config->address_map[address] : address == config->slave_address;
+    if (!match) {
         return -1;
     }
+    config->matched = match;
     
-    // Send ACK
-    if (i2c_slave_send_ack(config, 0) < 0) {
+    // Send ACK. Addressed, a register byte or a read follows, so stretch
+    // the clock until the caller has it ready (released by the next byte
+    // operation). Not done after data bytes, as a STOP may follow instead.
+    if (slave_ack(config, 0, 1) < 0) {
         return -1;
     }
     
     return read_write_bit;
 }
 
-// Slave reads a byte
-int i2c_slave_read_byte(I2C_Config *config) {
-    int i;
-    uint8_t byte = 0;
+// After I2C_SLAVE_RESTART: receive the address of the repeated START
+int i2c_slave_address(I2C_Config *config) {
+    return slave_address(config);
+}
+
+// Receive one bit, watching SDA for as long as SCL is high. SDA must hold
+// there; if it rises the master sent STOP, if it falls a repeated START.
+// Returns the bit, I2C_SLAVE_STOP, I2C_SLAVE_RESTART or -1 on timeout.
+static int slave_receive_bit(I2C_Config *config) {
+    int sda, scl;
+    int timeout = 0;
     
-    // Make sure SDA is in input mode
-    if (sda_set_mode(config, 1) < 0) {
-        return -1;
+    // Wait for SCL high
+    while (scl_read(config) == 0) {
+        if (++timeout >= I2C_WAIT_CYCLES) {
+            return -1;
+        }
+        line_delay(config, config->bit_delay / I2C_SMALL_DELAY_DIV);
     }
     
-    // Read 8 bits
-    for (i = 7; i >= 0; i--) {
-        // Wait for SCL high
-        while (gpiod_line_get_value(config->scl_line) == 0) {
-            usleep(1);
+    int bit = sda_read(config);
+    
+    // Wait for SCL low, checking that SDA holds
+    timeout = 0;
+    while (lines_read(config, &sda, &scl) == 0 && scl == 1) {
+        if (sda != bit) {
+            return sda ? I2C_SLAVE_STOP : I2C_SLAVE_RESTART;
         }
-        
-        // Read bit
-        if (gpiod_line_get_value(config->sda_line)) {
-            byte |= (1 << i);
+        if (++timeout >= I2C_WAIT_CYCLES) {
+            return -1;
         }
-        
-        // Wait for SCL low
-        while (gpiod_line_get_value(config->scl_line) == 1) {
-            usleep(1);
+        line_delay(config, config->bit_delay / I2C_SMALL_DELAY_DIV);
+    }
+    
+    return bit;
+}
+
+// Slave reads a byte. A STOP or repeated START in any bit ends the
+// transfer at once. Returns 0 with the byte received and ACKed,
+// I2C_SLAVE_STOP, I2C_SLAVE_RESTART or -1.
+int i2c_slave_read_byte_with_stop_check(I2C_Config *config, uint8_t *byte) {
+    int i;
+    
+    // Make sure SDA is released, then let the master clock the byte
+    sda_release(config);
+    scl_write(config, 1);
+    
+    *byte = 0;
+    for (i = 7; i >= 0; i--) {
+        int bit = slave_receive_bit(config);
+        if (bit < 0 || bit > 1) {
+            return bit;
         }
+        *byte |= bit << i;
     }
     
     // Send ACK
@@ -432,126 +632,137 @@ int i2c_slave_read_byte(I2C_Config *config) {
         return -1;
     }
     
-    return byte;
+    return 0;
 }
 
-// Slave writes a byte
-int i2c_slave_write_byte(I2C_Config *config, uint8_t byte) {
-    int i;
-    int timeout;
+// Slave reads a byte; -1 if the transfer ended instead
+int i2c_slave_read_byte(I2C_Config *config) {
+    uint8_t byte;
     
-    // Switch to output mode
-    if (sda_set_mode(config, 0) < 0) {
+    if (i2c_slave_read_byte_with_stop_check(config, &byte) != 0) {
         return -1;
     }
+    return byte;
+}
+
+// Shift a byte out on SDA, one bit per SCL low phase, then release SDA
+// for the master's ACK. The bits come pre-expanded into SDA levels, so
+// between SCL falling and the bit being valid there is only the line
+// write; SDA settles long before the master samples half a bit later.
+// On a wide bus a level holds every line's bit and is one bulk write.
+static int slave_send_bits(I2C_Config *config, const uint8_t *levels) {
+    int i;
+    int timeout;
     
     // Write 8 bits
-    for (i = 7; i >= 0; i--) {
+    for (i = 0; i < 8; i++) {
         // CRITICAL: Wait for SCL to be LOW before setting data
         timeout = I2C_TIMEOUT_US;
-        while (gpiod_line_get_value(config->scl_line) == 1 && timeout-- > 0) {
-            usleep(1);
+        while (scl_read(config) == 1 && timeout-- > 0) {
+            line_delay(config, 1);
         }
         if (timeout <= 0) return -1;
         
         // Set data bit while SCL is low
-        int bit = (byte >> i) & 1;
-        gpiod_line_set_value(config->sda_line, bit);
+        if (config->width > 1) {
+            sda_write_lines(config, levels[i]);
+        } else {
+            sda_write(config, levels[i]);
+        }
         
-        // Give time for data to stabilize before master samples
-        usleep(config->bit_delay / I2C_STABILIZATION_DIV);
+        // First bit is on SDA: stop stretching the clock
+        scl_write(config, 1);
         
         // Wait for SCL high (master samples data here)
         timeout = I2C_TIMEOUT_US;
-        while (gpiod_line_get_value(config->scl_line) == 0 && timeout-- > 0) {
-            usleep(1);
+        while (scl_read(config) == 0 && timeout-- > 0) {
+            line_delay(config, 1);
         }
         if (timeout <= 0) return -1;
         
         // Data must remain stable while SCL is high
         // Just wait for SCL to go low again
         timeout = I2C_TIMEOUT_US;
-        while (gpiod_line_get_value(config->scl_line) == 1 && timeout-- > 0) {
-            usleep(1);
+        while (scl_read(config) == 1 && timeout-- > 0) {
+            line_delay(config, 1);
         }
         if (timeout <= 0) return -1;
     }
     
-    // Release SDA line high before switching to input
-    gpiod_line_set_value(config->sda_line, 1);
-    usleep(config->bit_delay / I2C_SMALL_DELAY_DIV);  // Small delay for line to stabilize
-    
-    // Switch to input mode for ACK
-    if (sda_set_mode(config, 1) < 0) {
-        return -1;
+    // Release SDA so the master can drive ACK
+    sda_release(config);
+    return 0;
+}
+
+// SDA levels of a byte's bits, MSB first; a 1 bit is high, 0 is low
+static void expand_byte(uint8_t byte, uint8_t *levels, uint8_t high) {
+    for (int i = 0; i < 8; i++) {
+        levels[i] = (byte >> (7 - i)) & 1 ? high : 0;
     }
-    
-    // Wait for master to drive clock low
-    timeout = I2C_ACK_TIMEOUT;
-    while (gpiod_line_get_value(config->scl_line) == 1 && timeout-- > 0) {
-        usleep(1);
+}
+
+// Sample the master's ACK/NACK in the ninth clock. Only that one clock is
+// looked at: after a NACK the master goes on with STOP or repeated START,
+// whose SCL high phases must not be taken for an ACK.
+static int slave_get_ack(I2C_Config *config) {
+    int timeout = I2C_TIMEOUT_US;
+    while (scl_read(config) == 0 && timeout-- > 0) {
+        line_delay(config, 1);
     }
-    
     if (timeout <= 0) {
-        sda_set_mode(config, 0);  // Switch back to output
         return -1;  // Timeout waiting for clock
     }
     
-    // Read ACK bit with multiple attempts
-    int ack_received = 1;  // Default to NACK
-    int attempts = I2C_ACK_ATTEMPTS;
-    
-    while (attempts-- > 0) {
-        // Wait for clock to go high
-        timeout = I2C_ACK_TIMEOUT;
-        while (gpiod_line_get_value(config->scl_line) == 0 && timeout-- > 0) {
-            usleep(1);
-        }
-        
-        if (timeout > 0) {
-            // Read SDA multiple times when clock is high
-            int ack_reads = 0;
-            for (int i = 0; i < I2C_ACK_SAMPLES; i++) {
-                if (gpiod_line_get_value(config->sda_line) == 0) {
-                    ack_reads++;
-                }
-                usleep(1);
-            }
-            
-            // If majority of reads show ACK, consider it ACK
-            if (ack_reads >= I2C_ACK_THRESHOLD) {
-                ack_received = 0;
-                break;
-            }
-        }
-        
-        // Wait for clock to go low before next attempt
-        timeout = I2C_ACK_TIMEOUT;
-        while (gpiod_line_get_value(config->scl_line) == 1 && timeout-- > 0) {
-            usleep(1);
+    // Majority vote over a few samples while SCL is high
+    int ack_reads = 0;
+    for (int i = 0; i < I2C_ACK_SAMPLES; i++) {
+        if (sda_read(config) == 0) {
+            ack_reads++;
         }
     }
     
-    // Switch back to output mode
-    if (sda_set_mode(config, 0) < 0) {
-        return -1;
+    // Wait for the end of the ACK clock
+    timeout = I2C_TIMEOUT_US;
+    while (scl_read(config) == 1 && timeout-- > 0) {
+        line_delay(config, 1);
     }
     
-    // Return 0 for ACK, -1 for NACK
-    // For software I2C, we're more lenient - if data is flowing, assume success
-    if (ack_received == 0) {
-        return 0;  // Definite ACK
-    }
+    return ack_reads >= I2C_ACK_THRESHOLD ? 0 : 1;
+}
+
+// Slave writes a byte. Returns 0 if the master ACKed it, 1 on NACK.
+int i2c_slave_write_byte(I2C_Config *config, uint8_t byte) {
+    uint8_t levels[8];
     
-    // Return actual ACK status
-    return ack_received;
+    // The same byte on every line of a wide bus
+    expand_byte(byte, levels, all_lines(config));
+    if (slave_send_bits(config, levels) < 0) {
+        return -1;
+    }
+    return slave_get_ack(config);
+}
+
+// Read length bytes, ACKing all but the last; on a wide bus line n's bytes
+// go to buffer + n * length
+static void master_read_data(I2C_Config *config, uint8_t *buffer, int length) {
+    uint8_t bytes[I2C_WIDE_MAX];
+    int width = config->width > 1 ? config->width : 1;
+    
+    for (int i = 0; i < length; i++) {
+        i2c_read_byte_wide(config, i == length - 1, bytes);
+        for (int n = 0; n < width; n++) {
+            buffer[n * length + i] = bytes[n];
+        }
+    }
 }
 
 // Master writes multiple bytes
 int i2c_master_write(I2C_Config *config, uint8_t *data, int length) {
     int i;
     
-    i2c_start(config);
+    if (i2c_start(config) < 0) {
+        return -1;
+    }
     
     // Send address with write bit
     if (i2c_write_byte(config, (config->slave_address << 1) | 0) != 0) {
@@ -571,11 +782,36 @@ int i2c_master_write(I2C_Config *config, uint8_t *data, int length) {
     return 0;
 }
 
-// Master reads multiple bytes
-int i2c_master_read(I2C_Config *config, uint8_t *buffer, int length) {
+// Master writes, then reads after a repeated START, in one transfer. This
+// is the combined format for register reads: the register pointer write
+// and the read need no STOP and START between them.
+int i2c_master_write_read(I2C_Config *config, uint8_t *data, int write_length,
+                          uint8_t *buffer, int read_length) {
     int i;
+    unsigned long stretch_timeouts = config->stretch_timeouts;
     
-    i2c_start(config);
+    if (i2c_start(config) < 0) {
+        return -1;
+    }
+    
+    // Send address with write bit, then the data
+    if (i2c_write_byte(config, (config->slave_address << 1) | 0) != 0) {
+        i2c_stop(config);
+        return -1;
+    }
+    for (i = 0; i < write_length; i++) {
+        if (i2c_write_byte(config, data[i]) != 0) {
+            i2c_stop(config);
+            return -1;
+        }
+    }
+    
+    // Repeated START: i2c_start raises SDA while SCL is still low, so
+    // the slave never sees a STOP
+    if (i2c_start(config) < 0) {
+        i2c_stop(config);
+        return -1;
+    }
     
     // Send address with read bit
     if (i2c_write_byte(config, (config->slave_address << 1) | 1) != 0) {
@@ -583,66 +819,313 @@ int i2c_master_read(I2C_Config *config, uint8_t *buffer, int length) {
         return -1;
     }
     
-    // Read data
-    for (i = 0; i < length - 1; i++) {
-        buffer[i] = i2c_read_byte(config, 0); // ACK
-    }
-    buffer[length - 1] = i2c_read_byte(config, 1); // NACK
+    // Read data, NACKing the last byte
+    master_read_data(config, buffer, read_length);
     
     i2c_stop(config);
-    return 0;
+    return config->stretch_timeouts == stretch_timeouts ? 0 : -1;
 }
 
-// Function to read byte with STOP condition check
-int i2c_slave_read_byte_with_stop_check(I2C_Config *config, uint8_t *byte) {
-    // For now, just use regular read
-    int result = i2c_slave_read_byte(config);
-    if (result < 0) {
+// Master reads multiple bytes
+int i2c_master_read(I2C_Config *config, uint8_t *buffer, int length) {
+    unsigned long stretch_timeouts = config->stretch_timeouts;
+    
+    if (i2c_start(config) < 0) {
         return -1;
     }
-    *byte = (uint8_t)result;
-    return 0;
+    
+    // Send address with read bit
+    if (i2c_write_byte(config, (config->slave_address << 1) | 1) != 0) {
+        i2c_stop(config);
+        return -1;
+    }
+    
+    // Read data, NACKing the last byte
+    master_read_data(config, buffer, length);
+    
+    i2c_stop(config);
+    return config->stretch_timeouts == stretch_timeouts ? 0 : -1;
+}
+
+int i2c_master_write_delays(int length) {
+    return I2C_START_DELAYS + (length + 1) * I2C_WRITE_DELAYS + I2C_STOP_DELAYS;
+}
+
+int i2c_master_read_delays(int length) {
+    return I2C_START_DELAYS + I2C_WRITE_DELAYS + length * I2C_READ_DELAYS + I2C_STOP_DELAYS;
+}
+
+int i2c_master_write_read_delays(int write_length, int read_length) {
+    return i2c_master_write_delays(write_length) - I2C_STOP_DELAYS + i2c_master_read_delays(read_length);
 }
 
-// Slave write/read stubs for completeness
+// Slave streams bytes to the master, which ACKs each byte it wants more
+// after and NACKs the last one. Returns the number of bytes sent (the
+// NACKed one included), or -1 if the bus timed out before any was.
 int i2c_slave_write(I2C_Config *config, uint8_t *data, int length) {
-    (void)config;
-    (void)data;
-    (void)length;
-    return -1;  // Not implemented
+    int i;
+    
+    for (i = 0; i < length; i++) {
+        int ack = i2c_slave_write_byte(config, data[i]);
+        if (ack < 0) {
+            return i > 0 ? i : -1;
+        }
+        if (ack) {
+            return i + 1;
+        }
+    }
+    
+    return length;
+}
+
+// Expand byte i of a loaded response into its line levels
+static void response_expand(I2C_SlaveResponse *response, int i) {
+    const uint8_t *data = response->data;
+    
+    if (response->width == 1) {
+        expand_byte(data[i], response->levels[i], 1);
+        return;
+    }
+    // The reverse of i2c_read_byte_wide: one byte per line in, transposed
+    // into the level of every line per bit
+    uint64_t bytes = 0;
+    for (int n = 0; n < response->width; n++) {
+        bytes |= (uint64_t)data[n * response->length + i] << (8 * n);
+    }
+    bytes = transpose8(bytes);
+    for (int bit = 0; bit < 8; bit++) {
+        response->levels[i][bit] = bytes >> (8 * (7 - bit));
+    }
 }
 
+void i2c_slave_response_load(I2C_SlaveResponse *response, const uint8_t *data, int length) {
+    i2c_slave_response_load_wide(response, data, length, 1);
+}
+
+void i2c_slave_response_load_wide(I2C_SlaveResponse *response, const uint8_t *data, int length, int width) {
+    if (length > I2C_RESPONSE_MAX) {
+        length = I2C_RESPONSE_MAX;
+    }
+    response->data = data;
+    response->width = width;
+    response->length = length;
+    response->expanded = length < I2C_RESPONSE_AHEAD ? length : I2C_RESPONSE_AHEAD;
+    for (int i = 0; i < response->expanded; i++) {
+        response_expand(response, i);
+    }
+}
+
+int i2c_slave_write_response(I2C_Config *config, I2C_SlaveResponse *response) {
+    int i;
+    
+    for (i = 0; i < response->length; i++) {
+        // Past the prepared bytes: SCL is low after the ACK, and one byte
+        // expands well within the master's low phase
+        if (i == response->expanded) {
+            response_expand(response, response->expanded++);
+        }
+        if (slave_send_bits(config, response->levels[i]) < 0) {
+            return i > 0 ? i : -1;
+        }
+        int ack = slave_get_ack(config);
+        if (ack < 0) {
+            return i > 0 ? i : -1;
+        }
+        if (ack) {
+            return i + 1;
+        }
+    }
+    
+    return response->length;
+}
+
+// Slave receives length bytes, ACKing each
 int i2c_slave_read(I2C_Config *config, uint8_t *buffer, int length) {
-    (void)config;
-    (void)buffer;
-    (void)length;
-    return -1;  // Not implemented
+    int i;
+    
+    for (i = 0; i < length; i++) {
+        int byte = i2c_slave_read_byte(config);
+        if (byte < 0) {
+            return -1;
+        }
+        buffer[i] = (uint8_t)byte;
+    }
+    
+    return 0;
 }
 
 // Debug function
 void i2c_debug_status(I2C_Config *config) {
-    int sda_state = gpiod_line_get_value(config->sda_line);
-    int scl_state = gpiod_line_get_value(config->scl_line);
-    printf("DEBUG: SDA=%d, SCL=%d\n", sda_state, scl_state);
+    int sda_state = -1, scl_state = -1;
+    lines_read(config, &sda_state, &scl_state);
+    i2c_log(I2C_LOG_INFO, "DEBUG: SDA=%d, SCL=%d\n", sda_state, scl_state);
+}
+
+// Select the line backend by name
+int i2c_set_backend(I2C_Config *config, const char *name) {
+    for (size_t i = 0; i < sizeof(i2c_backends) / sizeof(i2c_backends[0]); i++) {
+        if (strcmp(name, i2c_backends[i]->name) == 0) {
+            config->ops = i2c_backends[i];
+            return 0;
+        }
+    }
+    fprintf(stderr, "Unknown line backend: %s\n", name);
+    return -1;
+}
+
+int i2c_parse_buses(const char *list, I2C_Config *const *buses, int max) {
+    const char *p = list;
+    int count;
+    
+    for (count = 0; *p; count++) {
+        int sda, scl, length;
+        if (count == max) {
+            fprintf(stderr, "At most %d buses\n", max);
+            return -1;
+        }
+        if (sscanf(p, "%d:%d%n", &sda, &scl, &length) != 2 || sda < 0 || scl < 0 || sda == scl) {
+            fprintf(stderr, "Bad bus \"%s\", expected SDA:SCL pins\n", p);
+            return -1;
+        }
+        buses[count]->sda_pin = sda;
+        buses[count]->scl_pin = scl;
+        p += length;
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return count > 0 ? count : -1;
+}
+
+int i2c_parse_wide(const char *list, int *sda_pins) {
+    const char *p = list;
+    int count;
+    
+    for (count = 0; *p; count++) {
+        int sda, length;
+        if (count == I2C_WIDE_MAX) {
+            fprintf(stderr, "At most %d SDA lines\n", I2C_WIDE_MAX);
+            return -1;
+        }
+        if (sscanf(p, "%d%n", &sda, &length) != 1 || sda < 0) {
+            fprintf(stderr, "Bad SDA line \"%s\", expected a pin\n", p);
+            return -1;
+        }
+        sda_pins[count] = sda;
+        p += length;
+        if (*p == ',') {
+            p++;
+        }
+    }
+    if (count < 2) {
+        fprintf(stderr, "A wide bus needs at least 2 SDA lines\n");
+        return -1;
+    }
+    return count;
+}
+
+// Name of the bus line on pin, or NULL if it is none of them
+static const char *bus_line(const I2C_Config *config, int pin) {
+    if (pin == config->scl_pin) {
+        return "SCL";
+    }
+    if (pin == config->sda_pin) {
+        return "SDA";
+    }
+    for (int n = 1; n < config->width; n++) {
+        if (pin == config->sda_pins[n]) {
+            return "SDA";
+        }
+    }
+    return NULL;
+}
+
+int i2c_check_aux_pins(I2C_Config *const *buses, int count, int first, int n, const char *name) {
+    const I2C_LineOps *ops = buses[0]->ops ? buses[0]->ops : i2c_backends[0];
+    
+    for (int pin = first; pin < first + n; pin++) {
+        if (pin < 0) {
+            fprintf(stderr, "%s on GPIO%d is not a valid pin\n", name, pin);
+            return -1;
+        }
+        if (ops->max_pin >= 0 && pin > ops->max_pin) {
+            fprintf(stderr, "%s on GPIO%d: the %s backend only has GPIO0-%d\n", name, pin, ops->name,
+                    ops->max_pin);
+            return -1;
+        }
+        for (int b = 0; b < count; b++) {
+            const char *line = bus_line(buses[b], pin);
+            if (line) {
+                fprintf(stderr, "%s on GPIO%d would drive %s of bus %d (%d:%d)\n", name, pin, line, b,
+                        buses[b]->sda_pin, buses[b]->scl_pin);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Sample SDA and SCL together
+int i2c_read_lines(I2C_Config *config, int *sda, int *scl) {
+    return lines_read(config, sda, scl);
+}
+
+// Release SDA back to the pull-up
+void i2c_release_sda(I2C_Config *config) {
+    sda_release(config);
+}
+
+void i2c_slave_release_scl(I2C_Config *config) {
+    scl_write(config, 1);
+}
+
+int i2c_aux_open(I2C_Config *config, int pin, int dir) {
+    if (!config->ops->aux_open) {
+        fprintf(stderr, "Backend %s has no auxiliary lines\n", config->ops->name);
+        return -1;
+    }
+    return config->ops->aux_open(config, pin, dir);
+}
+
+void i2c_aux_write(I2C_Config *config, int pin, int value) {
+    if (!config->ops->aux_set) {
+        fprintf(stderr, "Backend %s has no auxiliary lines\n", config->ops->name);
+        return;
+    }
+    config->ops->aux_set(config, pin, value);
+}
+
+int i2c_aux_wait(I2C_Config *config, int pin, int value, int timeout_us) {
+    if (!config->ops->aux_wait) {
+        fprintf(stderr, "Backend %s has no auxiliary lines\n", config->ops->name);
+        return -1;
+    }
+    return config->ops->aux_wait(config, pin, value, timeout_us);
+}
+
+// A wait without timeout returns the level at once
+int i2c_aux_read(I2C_Config *config, int pin) {
+    int result = i2c_aux_wait(config, pin, 1, 0);
+    return result < 0 ? -1 : result;
 }
 
 // Bus recovery - generate 9 clock pulses to release stuck slave
 void i2c_bus_recovery(I2C_Config *config) {
-    printf("Performing I2C bus recovery...\n");
+    i2c_log(I2C_LOG_INFO, "Performing I2C bus recovery...\n");
     
-    // Ensure SDA is in input mode
-    sda_set_mode(config, 1);
+    // Ensure SDA is released
+    sda_release(config);
     
     // Generate 9 clock pulses
     for (int i = 0; i < 9; i++) {
-        gpiod_line_set_value(config->scl_line, 0);
-        usleep(config->bit_delay);
-        gpiod_line_set_value(config->scl_line, 1);
-        usleep(config->bit_delay);
+        scl_write(config, 0);
+        line_delay(config, config->bit_delay);
+        scl_write(config, 1);
+        line_delay(config, config->bit_delay);
         
         // Check if SDA is released
-        if (gpiod_line_get_value(config->sda_line) == 1) {
-            printf("Bus recovery: SDA released after %d clocks\n", i + 1);
+        if (sda_read(config) == 1) {
+            i2c_log(I2C_LOG_INFO, "Bus recovery: SDA released after %d clocks\n", i + 1);
             break;
         }
     }
@@ -651,5 +1134,164 @@ void i2c_bus_recovery(I2C_Config *config) {
     i2c_stop(config);
     
     // Small delay to ensure bus is idle
-    usleep(config->bit_delay * 2);
-}
\ No newline at end of file
+    line_delay(config, config->bit_delay * 2);
+}
+
+void i2c_decoder_init(I2C_SlaveDecoder *dec, const I2C_SlaveHandler *handler, void *ctx) {
+    memset(dec, 0, sizeof(*dec));
+    dec->handler = handler;
+    dec->ctx = ctx;
+    dec->state = I2C_DEC_IDLE;
+    dec->sda = 1;
+    dec->scl = 1;
+}
+
+// Drop the current transfer and let go of SDA
+static void decoder_reset(I2C_Config *config, I2C_SlaveDecoder *dec) {
+    sda_release(config);
+    if (dec->state != I2C_DEC_IDLE && dec->state != I2C_DEC_IGNORE) {
+        dec->handler->stop(dec->ctx);
+    }
+    dec->state = I2C_DEC_IDLE;
+}
+
+// Load the next byte for the master and drive its MSB
+static void decoder_load_byte(I2C_Config *config, I2C_SlaveDecoder *dec) {
+    dec->byte = dec->handler->read(dec->ctx);
+    sda_write(config, (dec->byte >> 7) & 1);
+    dec->bit = 1;
+    dec->state = I2C_DEC_READ;
+}
+
+void i2c_decoder_feed(I2C_Config *config, I2C_SlaveDecoder *dec, const I2C_Edge *edge) {
+    int sda = edge->sda;
+    int scl = edge->scl;
+    
+    dec->edges++;
+    
+    // Abandon a transfer the master stopped clocking
+    if (dec->state != I2C_DEC_IDLE && dec->last_ts &&
+        edge->ts_ns - dec->last_ts > I2C_DECODER_TIMEOUT_NS) {
+        decoder_reset(config, dec);
+        dec->timeouts++;
+    }
+    dec->last_ts = edge->ts_ns;
+    
+    if (scl && dec->scl) {
+        // SDA changing while SCL is high is a START or STOP
+        if (dec->sda && !sda) {
+            // START or repeated START: the transfer (if any) continues
+            // with a new address byte
+            sda_release(config);
+            dec->state = I2C_DEC_ADDRESS;
+            dec->bit = 0;
+            dec->byte = 0;
+            dec->starts++;
+        } else if (!dec->sda && sda) {
+            decoder_reset(config, dec);
+            dec->stops++;
+        }
+    } else if (scl && !dec->scl) {
+        // Rising SCL: the master samples, so do we
+        if (dec->state == I2C_DEC_ADDRESS || dec->state == I2C_DEC_WRITE) {
+            dec->byte = (uint8_t)((dec->byte << 1) | (sda & 1));
+            dec->bit++;
+        } else if (dec->state == I2C_DEC_READ_ACK) {
+            dec->bit = sda;  // 1 = NACK
+        }
+    } else if (!scl && dec->scl) {
+        // Falling SCL: the next bit (ours or the master's) goes on SDA now
+        switch (dec->state) {
+        case I2C_DEC_ADDRESS:
+            if (dec->bit == 8) {
+                if (dec->handler->address(dec->ctx, dec->byte >> 1, dec->byte & 1) == 0) {
+                    sda_write(config, 0);
+                    dec->state = I2C_DEC_ADDR_ACK;
+                } else {
+                    dec->state = I2C_DEC_IGNORE;
+                }
+            }
+            break;
+        case I2C_DEC_ADDR_ACK:
+            if (dec->byte & 1) {
+                decoder_load_byte(config, dec);
+            } else {
+                sda_release(config);
+                dec->state = I2C_DEC_WRITE;
+                dec->bit = 0;
+                dec->byte = 0;
+            }
+            break;
+        case I2C_DEC_WRITE:
+            if (dec->bit == 8) {
+                if (dec->handler->write(dec->ctx, dec->byte) == 0) {
+                    sda_write(config, 0);
+                    dec->state = I2C_DEC_WRITE_ACK;
+                } else {
+                    dec->handler->stop(dec->ctx);
+                    dec->state = I2C_DEC_IGNORE;
+                }
+            }
+            break;
+        case I2C_DEC_WRITE_ACK:
+            sda_release(config);
+            dec->state = I2C_DEC_WRITE;
+            dec->bit = 0;
+            dec->byte = 0;
+            break;
+        case I2C_DEC_READ:
+            if (dec->bit < 8) {
+                sda_write(config, (dec->byte >> (7 - dec->bit)) & 1);
+                dec->bit++;
+            } else {
+                // Let go of SDA for the master's ACK, but stay its driver
+                // (backends that switch SDA direction keep it) until a NACK
+                sda_write(config, 1);
+                dec->state = I2C_DEC_READ_ACK;
+            }
+            break;
+        case I2C_DEC_READ_ACK:
+            if (dec->bit) {
+                // NACK ends the read; wait for STOP or repeated START
+                sda_release(config);
+                dec->handler->stop(dec->ctx);
+                dec->state = I2C_DEC_IGNORE;
+            } else {
+                decoder_load_byte(config, dec);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    
+    dec->sda = sda;
+    dec->scl = scl;
+}
+
+int i2c_slave_poll_events(I2C_Config *config, I2C_SlaveDecoder *dec, int timeout_us) {
+    I2C_Edge edges[I2C_EDGE_BATCH];
+    
+    if (!config->edge_events || !config->ops->read_edges) {
+        return -1;
+    }
+    
+    int n = config->ops->read_edges(config, edges, I2C_EDGE_BATCH, timeout_us);
+    if (n < 0) {
+        return -1;
+    }
+    
+    for (int i = 0; i < n; i++) {
+        trace_lines(config, edges[i].ts_ns, edges[i].sda, edges[i].scl);
+        i2c_decoder_feed(config, dec, &edges[i]);
+    }
+    
+    // Do not hold SDA forever for a master that went away mid-transfer
+    if (n == 0 && dec->state != I2C_DEC_IDLE && dec->state != I2C_DEC_IGNORE &&
+        monotonic_ns() - dec->last_ts > I2C_DECODER_TIMEOUT_NS) {
+        decoder_reset(config, dec);
+        dec->timeouts++;
+    }
+    
+    return n;
+}
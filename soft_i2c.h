@@ -3,21 +3,123 @@
 #define SOFT_I2C_H
 
 #include <stdint.h>
-#include <gpiod.h>
 #include <time.h>
+#include "i2c_delay.h"
+#include "i2c_trace.h"
 
-// Configuration for pins
+// SDA direction as tracked by the protocol code
+#define I2C_DIR_IN  0  // Released, the other side may drive
+#define I2C_DIR_OUT 1  // Driven by us
+
+#define I2C_AUX_MAX 4  // Auxiliary lines per bus (see I2C_LineOps)
+#define I2C_WIDE_MAX 8  // SDA lines of a wide bus (see I2C_Config.width)
+
+// Slave byte reception: the transfer ended instead of a byte arriving
+#define I2C_SLAVE_STOP      2  // STOP
+#define I2C_SLAVE_RESTART   3  // Repeated START, address follows
+
+// i2c_slave_listen: no START seen, but the lines moved (a transfer we lost)
+#define I2C_SLAVE_LOST     -2
+
+typedef struct I2C_Config I2C_Config;
+
+// Line levels right after an edge, as reported by a backend
 typedef struct {
+    uint64_t ts_ns;  // Edge timestamp (CLOCK_MONOTONIC where available)
+    uint8_t sda;
+    uint8_t scl;
+} I2C_Edge;
+
+// Line operations implemented by a backend. All protocol code in
+// soft_i2c.c goes through this table, so backends can be swapped per
+// deployment without touching the protocol. Lines are open-drain:
+// writing 1 releases a line to the pull-up, writing 0 pulls it low.
+typedef struct {
+    const char *name;
+    int max_pin;  // Highest pin it can drive, -1 when only the chip knows
+    int  (*open)(I2C_Config *config, const char *consumer);  // Acquire SDA/SCL, both released
+    void (*close)(I2C_Config *config);
+    void (*set_sda)(I2C_Config *config, int value);
+    void (*set_scl)(I2C_Config *config, int value);
+    int  (*read_lines)(I2C_Config *config, int *sda, int *scl);  // Sample both at the same instant
+    void (*set_sda_dir)(I2C_Config *config, int dir);  // Optional, NULL when writing 1 already releases SDA
+    void (*delay)(I2C_Config *config, int us);
+    
+    // Optional: wait up to timeout_us for edges on SDA/SCL and return up
+    // to max of them, oldest first (0 on timeout, -1 on error). Only used
+    // when the lines were opened with edge_events set.
+    int  (*read_edges)(I2C_Config *config, I2C_Edge *edges, int max, int timeout_us);
+    
+    // Optional: auxiliary lines next to the bus, e.g. the sensor's
+    // interrupt output. aux_open acquires a pin as an open-drain output
+    // (initially released) or as an input with edge detection; it is
+    // released by close. aux_wait waits up to timeout_us for the line to
+    // read value: 1 when it does, 0 on timeout, -1 on error.
+    int  (*aux_open)(I2C_Config *config, int pin, int dir);
+    void (*aux_set)(I2C_Config *config, int pin, int value);
+    int  (*aux_wait)(I2C_Config *config, int pin, int value, int timeout_us);
+    
+    // Optional: wide bus (config->width > 1), all SDA lines in one request.
+    // Bit n of levels is SDA line n. set_sda_lines drives every line at
+    // once; read_sda_lines samples them and SCL at the same instant. With
+    // a wide bus set_sda drives all lines and read_lines reports SDA high
+    // only when every line is.
+    void (*set_sda_lines)(I2C_Config *config, uint32_t levels);
+    int  (*read_sda_lines)(I2C_Config *config, uint32_t *levels, int *scl);
+} I2C_LineOps;
+
+// Available backends
+extern const I2C_LineOps i2c_gpiod_ops;  // libgpiod character device
+extern const I2C_LineOps i2c_mmio_ops;   // Direct GPIO registers through /dev/gpiomem
+extern const I2C_LineOps i2c_sim_ops;    // Simulated wire in shared memory
+
+// Configuration for pins
+struct I2C_Config {
     int sda_pin;  // Data pin
     int scl_pin;  // Clock pin
     uint8_t slave_address;  // I2C slave address
+    
+    // Slave: with address_map set, every 7-bit address whose entry is
+    // non-zero is ACKed and its entry stored in matched, so a slave that
+    // answers on several addresses finds the addressed instance in one
+    // lookup. The map may change between transfers (another thread).
+    const volatile uint8_t *address_map;  // 128 entries, NULL = slave_address only
+    int matched;  // Entry of the last ACKed address (1 without a map)
     int bit_delay;  // Delay in microseconds between bit operations
     
-    // GPIO handles (internal)
-    struct gpiod_chip *chip;
-    struct gpiod_line *sda_line;
-    struct gpiod_line *scl_line;
-} I2C_Config;
+    // Wide bus: width SDA lines sharing SCL, one device behind each, all
+    // clocked by the same bit sequence. Written bytes go to every line;
+    // each read byte is one byte per line (i2c_read_byte_wide). Not
+    // available with edge_events.
+    int width;  // SDA lines, 0 or 1 for a normal bus on sda_pin
+    int sda_pins[I2C_WIDE_MAX];  // SDA of line n; sda_pin becomes sda_pins[0]
+    uint32_t nacked;  // Master: lines that NACKed the last byte written, bit n = line n
+    
+    // Line backend
+    const I2C_LineOps *ops;  // NULL selects the default backend
+    const char *device;  // Backend device: gpiochip, register block or sim wire file (NULL = default)
+    void *line_priv;  // Backend state (internal)
+    int edge_events;  // Open lines for edge events (event-driven slave)
+    I2C_Delay timing;  // Bit delay engine, calibrated at init (set timing.spin_threshold_ns to tune)
+    
+    // Clock stretching
+    int clock_stretch;  // Slave: hold SCL low after each ACK until the next byte is ready
+    int stretch_timeout_us;  // Master: longest wait for a stretched SCL (0 = default)
+    unsigned long stretches;  // Master: SCL releases a slave held back
+    unsigned long stretch_timeouts;  // Master: SCL still low after stretch_timeout_us
+    
+    // Flight recorder: every line change is recorded when set (see i2c_trace.h)
+    I2C_Trace *trace;
+    
+    // Line state cache (internal)
+    int sda_out;  // Last level driven on SDA (1 = released to pull-up)
+    int scl_out;  // Last level driven on SCL (1 = released to pull-up)
+    int sda_dir;  // I2C_DIR_IN or I2C_DIR_OUT
+    int sda_in;   // SDA at the last sample
+    int scl_in;   // SCL at the last sample
+    uint32_t sda_lines_out;  // Wide bus: levels driven per line
+    uint32_t sda_lines_in;   // Wide bus: levels per line at the last sample
+};
 
 // Initialize software I2C with given configuration
 int i2c_init(I2C_Config *config);
@@ -35,20 +137,101 @@ void i2c_cleanup(I2C_Config *config);
 int i2c_start(I2C_Config *config);
 void i2c_stop(I2C_Config *config);
 int i2c_write_byte(I2C_Config *config, uint8_t byte);
-uint8_t i2c_read_byte(I2C_Config *config, int ack);
+uint8_t i2c_read_byte(I2C_Config *config, int ack);  // Line 0 on a wide bus
+
+// Read one byte from every line of a wide bus (one on a normal bus) in
+// the same 9 clocks: bytes[n] is line n's. Returns -1 on a clock stretch
+// timeout, counted in config->stretch_timeouts.
+int i2c_read_byte_wide(I2C_Config *config, int ack, uint8_t *bytes);
 
 // Slave functions
-int i2c_slave_listen(I2C_Config *config);
+int i2c_slave_listen(I2C_Config *config);  // R/W bit, I2C_SLAVE_LOST or -1
 int i2c_slave_read_byte(I2C_Config *config);
-int i2c_slave_write_byte(I2C_Config *config, uint8_t byte);
+int i2c_slave_write_byte(I2C_Config *config, uint8_t byte);  // 0 = ACK, 1 = NACK
 int i2c_slave_read_byte_with_stop_check(I2C_Config *config, uint8_t *byte);
+int i2c_slave_address(I2C_Config *config);  // After I2C_SLAVE_RESTART: R/W bit or -1
 
-// High-level functions
+// High-level functions. On a wide bus every write goes to all lines and
+// fails if any line NACKs (see config->nacked); a read fills width *
+// length bytes, line n's at buffer + n * length.
 int i2c_master_write(I2C_Config *config, uint8_t *data, int length);
 int i2c_master_read(I2C_Config *config, uint8_t *buffer, int length);
+int i2c_master_write_read(I2C_Config *config, uint8_t *data, int write_length,
+                          uint8_t *buffer, int read_length);
+
+// Bit delays a master write/read of length data bytes waits through, i.e.
+// its duration on an ideal bus is this times config->bit_delay
+int i2c_master_write_delays(int length);
+int i2c_master_read_delays(int length);
+int i2c_master_write_read_delays(int write_length, int read_length);
+
+// Slave streams data until the master NACKs a byte; returns bytes sent
 int i2c_slave_write(I2C_Config *config, uint8_t *data, int length);
+
+// Slave read response expanded ahead of time into the SDA level of every
+// bit, so that sending a bit is a single line write. Prepare it before
+// the master's read address arrives, not after the ACK. Only the first
+// I2C_RESPONSE_AHEAD bytes are expanded then; longer reads expand each
+// further byte after the master ACKed the one before.
+#define I2C_RESPONSE_MAX   256  // Bytes a response holds
+#define I2C_RESPONSE_AHEAD 16   // Bytes expanded up front: a result block burst
+
+typedef struct {
+    uint8_t levels[I2C_RESPONSE_MAX][8];  // Per byte, MSB first; bit n = line n on a wide bus
+    const uint8_t *data;  // The loaded bytes, for expanding the rest
+    int width;
+    int expanded;  // Bytes of levels filled in
+    int length;
+} I2C_SlaveResponse;
+
+// Load length bytes (at most I2C_RESPONSE_MAX) into response. data is
+// kept and must stay valid until the response is written.
+void i2c_slave_response_load(I2C_SlaveResponse *response, const uint8_t *data, int length);
+
+// Wide bus: load length bytes for each of width lines, line n's at
+// data + n * length, so that every line sends its own bytes
+void i2c_slave_response_load_wide(I2C_SlaveResponse *response, const uint8_t *data, int length, int width);
+
+// Like i2c_slave_write, from a loaded response
+int i2c_slave_write_response(I2C_Config *config, I2C_SlaveResponse *response);
 int i2c_slave_read(I2C_Config *config, uint8_t *buffer, int length);
 
+// Event-driven slave. Instead of polling the lines, the slave decodes
+// START/STOP and data bits from the backend's timestamped edge stream in a
+// non-blocking state machine and answers through these callbacks.
+typedef struct {
+    int  (*address)(void *ctx, uint8_t address, int read);  // Return 0 to ACK
+    int  (*write)(void *ctx, uint8_t byte);                 // Byte from master, return 0 to ACK
+    uint8_t (*read)(void *ctx);                             // Next byte to send to master
+    void (*stop)(void *ctx);                                // Transfer ended (STOP, NACK or timeout)
+} I2C_SlaveHandler;
+
+typedef struct {
+    const I2C_SlaveHandler *handler;
+    void *ctx;
+    int state;
+    int sda;  // Levels after the last edge
+    int scl;
+    int bit;  // Bits shifted into/out of the current byte
+    uint8_t byte;
+    uint64_t last_ts;
+    // Statistics
+    unsigned long edges;
+    unsigned long starts;
+    unsigned long stops;
+    unsigned long timeouts;
+} I2C_SlaveDecoder;
+
+void i2c_decoder_init(I2C_SlaveDecoder *dec, const I2C_SlaveHandler *handler, void *ctx);
+
+// Feed one edge into the decoder; drives SDA for ACK and read data
+void i2c_decoder_feed(I2C_Config *config, I2C_SlaveDecoder *dec, const I2C_Edge *edge);
+
+// Wait up to timeout_us for a batch of edges and decode it. Returns the
+// number of edges decoded, 0 on timeout or -1 if the backend has no edge
+// events.
+int i2c_slave_poll_events(I2C_Config *config, I2C_SlaveDecoder *dec, int timeout_us);
+
 // Get current timestamp in milliseconds
 uint64_t get_timestamp_ms(void);
 
@@ -58,4 +241,38 @@ void i2c_debug_status(I2C_Config *config);
 // Bus recovery
 void i2c_bus_recovery(I2C_Config *config);
 
+// Select the line backend by name ("gpiod", "gpiomem" or "sim")
+int i2c_set_backend(I2C_Config *config, const char *name);
+
+// Command line pin lists. "sda:scl[,sda:scl...]" sets the pins of up to
+// max buses and returns their number; "sda,sda[,...]" fills the 2 to
+// I2C_WIDE_MAX SDA lines of a wide bus and returns their number. Both
+// print what is wrong and return -1 on a bad list.
+int i2c_parse_buses(const char *list, I2C_Config *const *buses, int max);
+int i2c_parse_wide(const char *list, int *sda_pins);
+
+// Check the n auxiliary pins from first on (XSHUT or INT of a sensor
+// array) before they are opened: each must be within the backend's pins
+// and none may be an SDA or SCL line of any of the count buses. Prints the
+// clash and returns -1.
+int i2c_check_aux_pins(I2C_Config *const *buses, int count, int first, int n, const char *name);
+
+// Sample SDA and SCL at the same instant (one ioctl)
+int i2c_read_lines(I2C_Config *config, int *sda, int *scl);
+
+// Release SDA back to the pull-up (open-drain high)
+void i2c_release_sda(I2C_Config *config);
+
+// Slave: stop stretching the clock (no-op if SCL is not held)
+void i2c_slave_release_scl(I2C_Config *config);
+
+// Auxiliary lines (see I2C_LineOps): dir is I2C_DIR_OUT or I2C_DIR_IN
+int i2c_aux_open(I2C_Config *config, int pin, int dir);
+void i2c_aux_write(I2C_Config *config, int pin, int value);
+int i2c_aux_wait(I2C_Config *config, int pin, int value, int timeout_us);
+
+// Level of an auxiliary input right now (1 or 0), -1 on error. Does not
+// count as sampling the bus, so another thread may poll with it.
+int i2c_aux_read(I2C_Config *config, int pin);
+
 #endif // SOFT_I2C_H
\ No newline at end of file
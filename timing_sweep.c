@@ -0,0 +1,482 @@
+// timing_sweep.c - Run master and slave over a grid of timing parameters
+//
+// For every combination of bit delay, slave retry delay, slave
+// post-transaction delay and measurement frequency the slave is started
+// (locally or through a command template, e.g. over ssh), the master runs
+// a fixed number of cycles and its JSON summary is collected. The result
+// is written as CSV or JSON with the Pareto-optimal rows (no other row is
+// at least as reliable and as fast) marked.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define SWEEP_MAX_VALUES        64      // Values per parameter list
+#define SWEEP_DEFAULT_CYCLES    50
+#define SWEEP_DEFAULT_SETTLE_MS 300     // Time for the slave to attach before the master starts
+#define SWEEP_STOP_TIMEOUT_MS   2000    // Grace period for the slave after SIGINT
+#define SWEEP_MASTER_SLACK_S    10      // Added to the expected master run time
+#define SWEEP_LINE_MAX          4096
+#define SWEEP_CMD_MAX           1024
+
+#define SWEEP_DEFAULT_MASTER    "./i2c_vl53l0x_master"
+#define SWEEP_DEFAULT_SLAVE     "./vl53l0x_slave -b {backend} -d {device} -t {bit} -y {retry} -P {post}"
+
+typedef struct {
+    int values[SWEEP_MAX_VALUES];
+    int count;
+} ValueList;
+
+typedef struct {
+    int bit_delay_us;
+    int retry_delay_us;
+    int post_delay_us;
+    int frequency_hz;
+    int ok;  // Master produced a summary
+    int cycles;
+    int successful;
+    double success_rate;
+    double measurements_per_s;
+    double p50_us, p90_us, p99_us, max_us;
+    int pareto;
+} SweepResult;
+
+static volatile int interrupted = 0;
+
+static void handle_signal(int sig) {
+    (void)sig;
+    interrupted = 1;
+}
+
+// Parse "a,b,c" or "start:end:step"
+static int parse_list(const char *text, ValueList *list) {
+    int start, end, step;
+
+    list->count = 0;
+    if (sscanf(text, "%d:%d:%d", &start, &end, &step) == 3) {
+        if (step == 0 || (end - start) / step < 0) {
+            fprintf(stderr, "Bad range %s\n", text);
+            return -1;
+        }
+        for (int v = start; step > 0 ? v <= end : v >= end; v += step) {
+            if (list->count == SWEEP_MAX_VALUES) {
+                fprintf(stderr, "Range %s has more than %d values\n", text, SWEEP_MAX_VALUES);
+                return -1;
+            }
+            list->values[list->count++] = v;
+        }
+        return 0;
+    }
+
+    const char *p = text;
+    while (*p) {
+        char *end_ptr;
+        long v = strtol(p, &end_ptr, 10);
+        if (end_ptr == p || list->count == SWEEP_MAX_VALUES) {
+            fprintf(stderr, "Bad value list %s\n", text);
+            return -1;
+        }
+        list->values[list->count++] = (int)v;
+        p = *end_ptr == ',' ? end_ptr + 1 : end_ptr;
+        if (*end_ptr && *end_ptr != ',') {
+            fprintf(stderr, "Bad value list %s\n", text);
+            return -1;
+        }
+    }
+    return list->count > 0 ? 0 : -1;
+}
+
+// Expand {bit} {retry} {post} {backend} {device} in a command template
+static void expand_template(char *out, size_t size, const char *tmpl, const SweepResult *r,
+                            const char *backend, const char *device) {
+    size_t n = 0;
+
+    while (*tmpl && n + 1 < size) {
+        char value[256];
+        const char *key_end;
+
+        if (*tmpl == '{' && (key_end = strchr(tmpl, '}'))) {
+            size_t key_len = key_end - tmpl - 1;
+            value[0] = '\0';
+            if (key_len == 3 && !strncmp(tmpl + 1, "bit", 3)) {
+                snprintf(value, sizeof(value), "%d", r->bit_delay_us);
+            } else if (key_len == 5 && !strncmp(tmpl + 1, "retry", 5)) {
+                snprintf(value, sizeof(value), "%d", r->retry_delay_us);
+            } else if (key_len == 4 && !strncmp(tmpl + 1, "post", 4)) {
+                snprintf(value, sizeof(value), "%d", r->post_delay_us);
+            } else if (key_len == 7 && !strncmp(tmpl + 1, "backend", 7)) {
+                snprintf(value, sizeof(value), "%s", backend);
+            } else if (key_len == 6 && !strncmp(tmpl + 1, "device", 6)) {
+                snprintf(value, sizeof(value), "%s", device ? device : "");
+            } else {
+                out[n++] = *tmpl++;
+                continue;
+            }
+            n += snprintf(out + n, size - n, "%s", value);
+            if (n >= size) {
+                n = size - 1;
+            }
+            tmpl = key_end + 1;
+        } else {
+            out[n++] = *tmpl++;
+        }
+    }
+    out[n] = '\0';
+}
+
+static pid_t start_slave(const char *cmd) {
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        // Own process group, so the whole command (e.g. ssh) can be stopped
+        setpgid(0, 0);
+        int null_fd = open("/dev/null", O_RDWR);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+    if (pid > 0) {
+        setpgid(pid, pid);
+    }
+    return pid;
+}
+
+static int wait_timeout(pid_t pid, int timeout_ms) {
+    for (int waited = 0; waited < timeout_ms; waited += 10) {
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            return 0;
+        }
+        usleep(10000);
+    }
+    return -1;
+}
+
+static void stop_slave(pid_t pid) {
+    kill(-pid, SIGINT);
+    if (wait_timeout(pid, SWEEP_STOP_TIMEOUT_MS) < 0) {
+        kill(-pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+}
+
+static double json_number(const char *line, const char *key) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char *p = strstr(line, pattern);
+    return p ? strtod(p + strlen(pattern), NULL) : 0.0;
+}
+
+// Run the master for one combination and parse its JSON summary
+static int run_master(const char *master, const char *backend, const char *device,
+                      int cycles, SweepResult *r) {
+    char bit[16], freq[16], count[16];
+    const char *argv[16];
+    int argc = 0;
+    int fds[2];
+
+    snprintf(bit, sizeof(bit), "%d", r->bit_delay_us);
+    snprintf(freq, sizeof(freq), "%d", r->frequency_hz);
+    snprintf(count, sizeof(count), "%d", cycles);
+    argv[argc++] = master;
+    argv[argc++] = "-b";
+    argv[argc++] = backend;
+    if (device) {
+        argv[argc++] = "-d";
+        argv[argc++] = device;
+    }
+    argv[argc++] = "-t";
+    argv[argc++] = bit;
+    argv[argc++] = "-f";
+    argv[argc++] = freq;
+    argv[argc++] = "-n";
+    argv[argc++] = count;
+    argv[argc++] = "-j";
+    argv[argc] = NULL;
+
+    if (pipe(fds) < 0) {
+        fprintf(stderr, "pipe: %s\n", strerror(errno));
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "fork: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_RDWR);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execv(master, (char *const *)argv);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    // Two measurement periods per cycle, plus slack for failures
+    int limit_s = cycles * 2 / r->frequency_hz + cycles + SWEEP_MASTER_SLACK_S;
+    time_t deadline = time(NULL) + limit_s;
+    char buf[SWEEP_LINE_MAX], line[SWEEP_LINE_MAX], summary[SWEEP_LINE_MAX] = "";
+    size_t line_len = 0;
+    int stopped = 0;
+
+    for (;;) {
+        struct pollfd pfd = { fds[0], POLLIN, 0 };
+        int ready = poll(&pfd, 1, 100);
+
+        if (!stopped && (interrupted || time(NULL) > deadline)) {
+            // SIGINT makes the master stop and still print its summary
+            kill(pid, SIGINT);
+            stopped = 1;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+
+        ssize_t n = read(fds[0], buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] == '\n') {
+                line[line_len] = '\0';
+                if (line[0] == '{') {
+                    memcpy(summary, line, line_len + 1);
+                }
+                line_len = 0;
+            } else if (line_len + 1 < sizeof(line)) {
+                line[line_len++] = buf[i];
+            }
+        }
+    }
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+
+    if (!summary[0]) {
+        return -1;
+    }
+    r->ok = 1;
+    r->cycles = (int)json_number(summary, "cycles");
+    r->successful = (int)json_number(summary, "successful");
+    r->success_rate = json_number(summary, "success_rate");
+    r->measurements_per_s = json_number(summary, "measurements_per_s");
+    r->p50_us = json_number(summary, "p50");
+    r->p90_us = json_number(summary, "p90");
+    r->p99_us = json_number(summary, "p99");
+    r->max_us = json_number(summary, "max");
+    return 0;
+}
+
+// A row is Pareto-optimal if no other row is at least as good in both
+// success rate and throughput and better in one of them
+static void mark_pareto(SweepResult *results, int count) {
+    for (int i = 0; i < count; i++) {
+        results[i].pareto = results[i].ok;
+        for (int j = 0; j < count && results[i].pareto; j++) {
+            if (j == i || !results[j].ok) {
+                continue;
+            }
+            if (results[j].success_rate >= results[i].success_rate &&
+                results[j].measurements_per_s >= results[i].measurements_per_s &&
+                (results[j].success_rate > results[i].success_rate ||
+                 results[j].measurements_per_s > results[i].measurements_per_s)) {
+                results[i].pareto = 0;
+            }
+        }
+    }
+}
+
+static void write_csv(FILE *out, const SweepResult *results, int count) {
+    fprintf(out, "bit_delay_us,retry_delay_us,post_delay_us,frequency_hz,cycles,successful,"
+                 "success_rate,measurements_per_s,latency_p50_us,latency_p90_us,latency_p99_us,"
+                 "latency_max_us,pareto\n");
+    for (int i = 0; i < count; i++) {
+        const SweepResult *r = &results[i];
+        fprintf(out, "%d,%d,%d,%d,%d,%d,%.2f,%.3f,%.1f,%.1f,%.1f,%.1f,%d\n",
+                r->bit_delay_us, r->retry_delay_us, r->post_delay_us, r->frequency_hz,
+                r->cycles, r->successful, r->success_rate, r->measurements_per_s,
+                r->p50_us, r->p90_us, r->p99_us, r->max_us, r->pareto);
+    }
+}
+
+static void write_json(FILE *out, const SweepResult *results, int count) {
+    fprintf(out, "[\n");
+    for (int i = 0; i < count; i++) {
+        const SweepResult *r = &results[i];
+        fprintf(out, "  {\"bit_delay_us\":%d,\"retry_delay_us\":%d,\"post_delay_us\":%d,"
+                     "\"frequency_hz\":%d,\"ok\":%s,\"cycles\":%d,\"successful\":%d,"
+                     "\"success_rate\":%.2f,\"measurements_per_s\":%.3f,"
+                     "\"latency_us\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f},"
+                     "\"pareto\":%s}%s\n",
+                r->bit_delay_us, r->retry_delay_us, r->post_delay_us, r->frequency_hz,
+                r->ok ? "true" : "false", r->cycles, r->successful, r->success_rate,
+                r->measurements_per_s, r->p50_us, r->p90_us, r->p99_us, r->max_us,
+                r->pareto ? "true" : "false", i + 1 < count ? "," : "");
+    }
+    fprintf(out, "]\n");
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-t list] [-y list] [-P list] [-f list] [-n cycles]\n"
+                    "          [-b backend] [-d device] [-s slave-cmd] [-m master] [-w ms]\n"
+                    "          [-F csv|json] [-o file]\n", prog);
+    fprintf(stderr, "Lists are \"a,b,c\" or \"start:end:step\".\n");
+    fprintf(stderr, "  -t  Bit delays in us (default: 2000)\n");
+    fprintf(stderr, "  -y  Slave retry delays in us (default: 1400)\n");
+    fprintf(stderr, "  -P  Slave post-transaction delays in us (default: 500)\n");
+    fprintf(stderr, "  -f  Measurement frequencies in Hz (default: 5)\n");
+    fprintf(stderr, "  -n  Measurement cycles per combination (default: %d)\n", SWEEP_DEFAULT_CYCLES);
+    fprintf(stderr, "  -b  Line backend of the master (default: sim)\n");
+    fprintf(stderr, "  -d  Backend device (sim default: a fresh wire file per run)\n");
+    fprintf(stderr, "  -s  Slave command; {bit} {retry} {post} {backend} {device} are\n");
+    fprintf(stderr, "      replaced (default: \"%s\")\n", SWEEP_DEFAULT_SLAVE);
+    fprintf(stderr, "  -m  Master binary (default: %s)\n", SWEEP_DEFAULT_MASTER);
+    fprintf(stderr, "  -w  Slave settle time in ms before the master starts (default: %d)\n",
+            SWEEP_DEFAULT_SETTLE_MS);
+    fprintf(stderr, "  -F  Output format (default: csv)\n");
+    fprintf(stderr, "  -o  Output file (default: stdout)\n");
+}
+
+int main(int argc, char *argv[]) {
+    ValueList bit_delays, retry_delays, post_delays, frequencies;
+    const char *backend = "sim";
+    const char *device = NULL;
+    const char *slave_tmpl = SWEEP_DEFAULT_SLAVE;
+    const char *master = SWEEP_DEFAULT_MASTER;
+    const char *format = "csv";
+    const char *output = NULL;
+    int cycles = SWEEP_DEFAULT_CYCLES;
+    int settle_ms = SWEEP_DEFAULT_SETTLE_MS;
+    char sim_wire[64];
+
+    parse_list("2000", &bit_delays);
+    parse_list("1400", &retry_delays);
+    parse_list("500", &post_delays);
+    parse_list("5", &frequencies);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:y:P:f:n:b:d:s:m:w:F:o:h")) != -1) {
+        int bad = 0;
+        switch (opt) {
+        case 't': bad = parse_list(optarg, &bit_delays); break;
+        case 'y': bad = parse_list(optarg, &retry_delays); break;
+        case 'P': bad = parse_list(optarg, &post_delays); break;
+        case 'f': bad = parse_list(optarg, &frequencies); break;
+        case 'n': cycles = atoi(optarg); break;
+        case 'b': backend = optarg; break;
+        case 'd': device = optarg; break;
+        case 's': slave_tmpl = optarg; break;
+        case 'm': master = optarg; break;
+        case 'w': settle_ms = atoi(optarg); break;
+        case 'F': format = optarg; break;
+        case 'o': output = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+        if (bad < 0) {
+            return 1;
+        }
+    }
+    if (cycles <= 0 || (strcmp(format, "csv") && strcmp(format, "json"))) {
+        usage(argv[0]);
+        return 1;
+    }
+    for (int i = 0; i < frequencies.count; i++) {
+        if (frequencies.values[i] <= 0) {
+            fprintf(stderr, "Frequencies must be positive\n");
+            return 1;
+        }
+    }
+
+    // The simulated bus gets a private wire, so no stale endpoint interferes
+    int own_wire = !device && !strcmp(backend, "sim");
+    if (own_wire) {
+        snprintf(sim_wire, sizeof(sim_wire), "/dev/shm/i2c_sweep_%d", (int)getpid());
+        device = sim_wire;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    int total = bit_delays.count * retry_delays.count * post_delays.count * frequencies.count;
+    SweepResult *results = calloc(total, sizeof(*results));
+    if (!results) {
+        return 1;
+    }
+
+    int count = 0;
+    for (int b = 0; b < bit_delays.count && !interrupted; b++) {
+        for (int y = 0; y < retry_delays.count && !interrupted; y++) {
+            for (int p = 0; p < post_delays.count && !interrupted; p++) {
+                for (int f = 0; f < frequencies.count && !interrupted; f++) {
+                    SweepResult *r = &results[count++];
+                    char cmd[SWEEP_CMD_MAX];
+
+                    r->bit_delay_us = bit_delays.values[b];
+                    r->retry_delay_us = retry_delays.values[y];
+                    r->post_delay_us = post_delays.values[p];
+                    r->frequency_hz = frequencies.values[f];
+
+                    fprintf(stderr, "[%d/%d] bit %d us, retry %d us, post %d us, %d Hz: ",
+                            count, total, r->bit_delay_us, r->retry_delay_us,
+                            r->post_delay_us, r->frequency_hz);
+
+                    if (own_wire) {
+                        unlink(device);
+                    }
+                    expand_template(cmd, sizeof(cmd), slave_tmpl, r, backend, device);
+                    pid_t slave = start_slave(cmd);
+                    if (slave < 0) {
+                        fprintf(stderr, "failed to start slave\n");
+                        continue;
+                    }
+                    usleep(settle_ms * 1000);
+
+                    if (run_master(master, backend, device, cycles, r) < 0) {
+                        fprintf(stderr, "no result\n");
+                    } else {
+                        fprintf(stderr, "%.1f%% success, %.2f meas/s, p99 %.1f us\n",
+                                r->success_rate, r->measurements_per_s, r->p99_us);
+                    }
+                    stop_slave(slave);
+                }
+            }
+        }
+    }
+    if (own_wire) {
+        unlink(device);
+    }
+
+    mark_pareto(results, count);
+
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Failed to open %s: %s\n", output, strerror(errno));
+        free(results);
+        return 1;
+    }
+    if (!strcmp(format, "json")) {
+        write_json(out, results, count);
+    } else {
+        write_csv(out, results, count);
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    free(results);
+    return interrupted ? 1 : 0;
+}
@@ -0,0 +1,417 @@
+// vl53l0x_device.c - Virtual VL53L0X register model
+#include "vl53l0x_device.h"
+#include "vl53l0x_io.h"
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+// Registers only the ST API initialization (DataInit, StaticInit, SPAD and
+// reference calibration) touches; the shared ones are in vl53l0x_io.h
+#define REG_SYSTEM_SEQUENCE_CONFIG                   0x01
+#define REG_SYSTEM_RANGE_CONFIG                      0x09
+#define REG_SYSTEM_THRESH_HIGH                       0x0C
+#define REG_SYSTEM_THRESH_LOW                        0x0E
+#define REG_CROSSTALK_COMPENSATION_PEAK_RATE_MCPS    0x20
+#define REG_PRE_RANGE_CONFIG_MIN_SNR                 0x27
+#define REG_ALGO_PART_TO_PART_RANGE_OFFSET_MM        0x28
+#define REG_ALGO_PHASECAL_LIM                        0x30
+#define REG_GLOBAL_CONFIG_VCSEL_WIDTH                0x32
+#define REG_HISTOGRAM_CONFIG_INITIAL_PHASE_SELECT    0x33
+#define REG_FINAL_RANGE_CONFIG_MIN_COUNT_RATE_RTN_LIMIT 0x44
+#define REG_MSRC_CONFIG_TIMEOUT_MACROP               0x46
+#define REG_FINAL_RANGE_CONFIG_VALID_PHASE_LOW       0x47
+#define REG_FINAL_RANGE_CONFIG_VALID_PHASE_HIGH      0x48
+#define REG_DYNAMIC_SPAD_NUM_REQUESTED_REF_SPAD      0x4E
+#define REG_DYNAMIC_SPAD_REF_EN_START_OFFSET         0x4F
+#define REG_PRE_RANGE_CONFIG_VCSEL_PERIOD            0x50
+#define REG_PRE_RANGE_CONFIG_TIMEOUT_MACROP          0x51
+#define REG_HISTOGRAM_CONFIG_READOUT_CTRL            0x55
+#define REG_PRE_RANGE_CONFIG_VALID_PHASE_LOW         0x56
+#define REG_PRE_RANGE_CONFIG_VALID_PHASE_HIGH        0x57
+#define REG_MSRC_CONFIG_CONTROL                      0x60
+#define REG_PRE_RANGE_CONFIG_SIGMA_THRESH_HI         0x61
+#define REG_PRE_RANGE_CONFIG_SIGMA_THRESH_LO         0x62
+#define REG_PRE_RANGE_MIN_COUNT_RATE_RTN_LIMIT       0x64
+#define REG_FINAL_RANGE_CONFIG_MIN_SNR               0x67
+#define REG_FINAL_RANGE_CONFIG_VCSEL_PERIOD          0x70
+#define REG_FINAL_RANGE_CONFIG_TIMEOUT_MACROP        0x71
+#define REG_POWER_MANAGEMENT_GO1_POWER_FORCE         0x80
+#define REG_SYSTEM_HISTOGRAM_BIN                     0x81
+#define REG_I2C_MODE                                 0x88
+#define REG_VHV_CONFIG_PAD_SCL_SDA_EXTSUP_HV         0x89
+#define REG_GLOBAL_CONFIG_SPAD_ENABLES_REF_0         0xB0
+#define REG_GLOBAL_CONFIG_REF_EN_START_SELECT        0xB6
+#define REG_SOFT_RESET_GO2_SOFT_RESET_N              0xBF
+#define REG_OSC_CALIBRATE_VAL                        0xF8
+#define REG_PAGE_SELECT                              0xFF
+
+// Private registers of the "stop variable" and SPAD info sequences
+#define REG_P1_STOP_VARIABLE   0x91  // Page 1
+#define REG_P6_NVM_CONTROL     0x83  // Page 6
+#define REG_P7_NVM_CONTROL     0x83  // Page 7: 0x00 starts a read, non-zero when done
+#define REG_P7_NVM_ADDRESS     0x94
+#define REG_P7_SPAD_INFO       0x92
+
+// Simulated NVM contents and result block
+#define SIM_STOP_VARIABLE   0x3C
+#define SIM_SPAD_INFO       0x85    // Aperture SPADs, 5 of them
+#define SIM_SIGNAL_RATE     0x0A00  // 20 MCPS in 9.7 fixed point
+#define SIM_AMBIENT_RATE    0x0040  // 0.5 MCPS
+#define SIM_EFFECTIVE_SPADS 0x0500  // 5 SPADs in 8.8 fixed point
+#define SIM_INITIAL_DISTANCE_MM 500
+#define SIM_DISTANCE_STEP_MM 10
+#define SIM_MIN_DISTANCE_MM 100
+#define SIM_MAX_DISTANCE_MM 1000
+
+static void on_page_select(VL53L0X_Device *dev, uint8_t reg, uint8_t value);
+static void on_sysrange_start(VL53L0X_Device *dev, uint8_t reg, uint8_t value);
+static void on_interrupt_clear(VL53L0X_Device *dev, uint8_t reg, uint8_t value);
+static void on_interrupt_config(VL53L0X_Device *dev, uint8_t reg, uint8_t value);
+static void on_nvm_read(VL53L0X_Device *dev, uint8_t reg, uint8_t value);
+static void on_address(VL53L0X_Device *dev, uint8_t reg, uint8_t value);
+
+// Plain register of page 0, and its read-only variant
+#define RW(reg, reset, name) { 0, reg, reset, 0xFF, 0, NULL, name }
+#define RO(reg, reset, name) { 0, reg, reset, 0x00, 0, NULL, name }
+
+static const VL53L0X_RegisterDef register_table[] = {
+    { 0, VL53L0X_REG_SYSRANGE_START, 0x00, 0xFF, 0, on_sysrange_start, "SYSRANGE_START" },
+    RW(REG_SYSTEM_SEQUENCE_CONFIG, 0xFF, "SYSTEM_SEQUENCE_CONFIG"),
+    RW(VL53L0X_REG_SYSTEM_INTERMEASUREMENT_PERIOD, 0x00, "SYSTEM_INTERMEASUREMENT_PERIOD"),
+    RW(VL53L0X_REG_SYSTEM_INTERMEASUREMENT_PERIOD + 1, 0x00, "SYSTEM_INTERMEASUREMENT_PERIOD+1"),
+    RW(VL53L0X_REG_SYSTEM_INTERMEASUREMENT_PERIOD + 2, 0x00, "SYSTEM_INTERMEASUREMENT_PERIOD+2"),
+    RW(VL53L0X_REG_SYSTEM_INTERMEASUREMENT_PERIOD + 3, 0x00, "SYSTEM_INTERMEASUREMENT_PERIOD+3"),
+    RW(REG_SYSTEM_RANGE_CONFIG, 0x00, "SYSTEM_RANGE_CONFIG"),
+    { 0, VL53L0X_REG_SYSTEM_INTERRUPT_CONFIG_GPIO, 0x00, 0x07, 0, on_interrupt_config,
+      "SYSTEM_INTERRUPT_CONFIG_GPIO" },
+    { 0, VL53L0X_REG_SYSTEM_INTERRUPT_CLEAR, 0x00, 0x03, 0, on_interrupt_clear, "SYSTEM_INTERRUPT_CLEAR" },
+    RW(REG_SYSTEM_THRESH_HIGH, 0x00, "SYSTEM_THRESH_HIGH"),
+    RW(REG_SYSTEM_THRESH_HIGH + 1, 0x00, "SYSTEM_THRESH_HIGH+1"),
+    RW(REG_SYSTEM_THRESH_LOW, 0x00, "SYSTEM_THRESH_LOW"),
+    RW(REG_SYSTEM_THRESH_LOW + 1, 0x00, "SYSTEM_THRESH_LOW+1"),
+
+    // Result block, read in one burst by the ST API
+    RO(VL53L0X_REG_RESULT_INTERRUPT_STATUS, 0x00, "RESULT_INTERRUPT_STATUS"),
+    RO(VL53L0X_REG_RESULT_RANGE_STATUS, 0x00, "RESULT_RANGE_STATUS"),
+    RO(VL53L0X_REG_RESULT_RANGE_STATUS + 1, 0x00, "RESULT_RANGE_STATUS+1"),
+    RO(VL53L0X_REG_RESULT_RANGE_STATUS + 2, SIM_EFFECTIVE_SPADS >> 8, "RESULT_EFFECTIVE_SPAD_RTN_COUNT"),
+    RO(VL53L0X_REG_RESULT_RANGE_STATUS + 3, SIM_EFFECTIVE_SPADS & 0xFF, "RESULT_EFFECTIVE_SPAD_RTN_COUNT+1"),
+    RO(VL53L0X_REG_RESULT_RANGE_STATUS + 4, 0x00, "RESULT_RANGE_STATUS+4"),
+    RO(VL53L0X_REG_RESULT_RANGE_STATUS + 5, 0x00, "RESULT_RANGE_STATUS+5"),
+    RO(VL53L0X_REG_RESULT_RANGE_STATUS + 6, SIM_SIGNAL_RATE >> 8, "RESULT_SIGNAL_RATE_RTN"),
+    RO(VL53L0X_REG_RESULT_RANGE_STATUS + 7, SIM_SIGNAL_RATE & 0xFF, "RESULT_SIGNAL_RATE_RTN+1"),
+    RO(VL53L0X_REG_RESULT_RANGE_STATUS + 8, SIM_AMBIENT_RATE >> 8, "RESULT_AMBIENT_RATE_RTN"),
+    RO(VL53L0X_REG_RESULT_RANGE_STATUS + 9, SIM_AMBIENT_RATE & 0xFF, "RESULT_AMBIENT_RATE_RTN+1"),
+    RO(VL53L0X_REG_RESULT_RANGE_VAL, SIM_INITIAL_DISTANCE_MM >> 8, "RESULT_RANGE_VAL"),
+    RO(VL53L0X_REG_RESULT_RANGE_VAL + 1, SIM_INITIAL_DISTANCE_MM & 0xFF, "RESULT_RANGE_VAL+1"),
+
+    // Static configuration and tuning
+    RW(REG_CROSSTALK_COMPENSATION_PEAK_RATE_MCPS, 0x00, "CROSSTALK_COMPENSATION_PEAK_RATE_MCPS"),
+    RW(REG_CROSSTALK_COMPENSATION_PEAK_RATE_MCPS + 1, 0x00, "CROSSTALK_COMPENSATION_PEAK_RATE_MCPS+1"),
+    RW(REG_PRE_RANGE_CONFIG_MIN_SNR, 0x00, "PRE_RANGE_CONFIG_MIN_SNR"),
+    RW(REG_ALGO_PART_TO_PART_RANGE_OFFSET_MM, 0x00, "ALGO_PART_TO_PART_RANGE_OFFSET_MM"),
+    RW(REG_ALGO_PART_TO_PART_RANGE_OFFSET_MM + 1, 0x00, "ALGO_PART_TO_PART_RANGE_OFFSET_MM+1"),
+    RW(REG_ALGO_PHASECAL_LIM, 0x00, "ALGO_PHASECAL_LIM"),
+    RW(REG_GLOBAL_CONFIG_VCSEL_WIDTH, 0x00, "GLOBAL_CONFIG_VCSEL_WIDTH"),
+    RW(REG_HISTOGRAM_CONFIG_INITIAL_PHASE_SELECT, 0x00, "HISTOGRAM_CONFIG_INITIAL_PHASE_SELECT"),
+    RW(REG_FINAL_RANGE_CONFIG_MIN_COUNT_RATE_RTN_LIMIT, 0x00, "FINAL_RANGE_CONFIG_MIN_COUNT_RATE_RTN_LIMIT"),
+    RW(REG_FINAL_RANGE_CONFIG_MIN_COUNT_RATE_RTN_LIMIT + 1, 0x20, "FINAL_RANGE_CONFIG_MIN_COUNT_RATE_RTN_LIMIT+1"),
+    RW(REG_MSRC_CONFIG_TIMEOUT_MACROP, 0x00, "MSRC_CONFIG_TIMEOUT_MACROP"),
+    RW(REG_FINAL_RANGE_CONFIG_VALID_PHASE_LOW, 0x00, "FINAL_RANGE_CONFIG_VALID_PHASE_LOW"),
+    RW(REG_FINAL_RANGE_CONFIG_VALID_PHASE_HIGH, 0x00, "FINAL_RANGE_CONFIG_VALID_PHASE_HIGH"),
+    RW(REG_DYNAMIC_SPAD_NUM_REQUESTED_REF_SPAD, 0x00, "DYNAMIC_SPAD_NUM_REQUESTED_REF_SPAD"),
+    RW(REG_DYNAMIC_SPAD_REF_EN_START_OFFSET, 0x00, "DYNAMIC_SPAD_REF_EN_START_OFFSET"),
+    RW(REG_PRE_RANGE_CONFIG_VCSEL_PERIOD, 0x06, "PRE_RANGE_CONFIG_VCSEL_PERIOD"),  // 14 PCLKs
+    RW(REG_PRE_RANGE_CONFIG_TIMEOUT_MACROP, 0x00, "PRE_RANGE_CONFIG_TIMEOUT_MACROP_HI"),
+    RW(REG_PRE_RANGE_CONFIG_TIMEOUT_MACROP + 1, 0x00, "PRE_RANGE_CONFIG_TIMEOUT_MACROP_LO"),
+    RW(REG_HISTOGRAM_CONFIG_READOUT_CTRL, 0x00, "HISTOGRAM_CONFIG_READOUT_CTRL"),
+    RW(REG_PRE_RANGE_CONFIG_VALID_PHASE_LOW, 0x00, "PRE_RANGE_CONFIG_VALID_PHASE_LOW"),
+    RW(REG_PRE_RANGE_CONFIG_VALID_PHASE_HIGH, 0x00, "PRE_RANGE_CONFIG_VALID_PHASE_HIGH"),
+    RW(REG_MSRC_CONFIG_CONTROL, 0x00, "MSRC_CONFIG_CONTROL"),
+    RW(REG_PRE_RANGE_CONFIG_SIGMA_THRESH_HI, 0x00, "PRE_RANGE_CONFIG_SIGMA_THRESH_HI"),
+    RW(REG_PRE_RANGE_CONFIG_SIGMA_THRESH_LO, 0x00, "PRE_RANGE_CONFIG_SIGMA_THRESH_LO"),
+    RW(REG_PRE_RANGE_MIN_COUNT_RATE_RTN_LIMIT, 0x00, "PRE_RANGE_MIN_COUNT_RATE_RTN_LIMIT"),
+    RW(REG_PRE_RANGE_MIN_COUNT_RATE_RTN_LIMIT + 1, 0x00, "PRE_RANGE_MIN_COUNT_RATE_RTN_LIMIT+1"),
+    RW(REG_FINAL_RANGE_CONFIG_MIN_SNR, 0x00, "FINAL_RANGE_CONFIG_MIN_SNR"),
+    RW(REG_FINAL_RANGE_CONFIG_VCSEL_PERIOD, 0x04, "FINAL_RANGE_CONFIG_VCSEL_PERIOD"),  // 10 PCLKs
+    RW(REG_FINAL_RANGE_CONFIG_TIMEOUT_MACROP, 0x00, "FINAL_RANGE_CONFIG_TIMEOUT_MACROP_HI"),
+    RW(REG_FINAL_RANGE_CONFIG_TIMEOUT_MACROP + 1, 0x00, "FINAL_RANGE_CONFIG_TIMEOUT_MACROP_LO"),
+    RW(REG_SYSTEM_HISTOGRAM_BIN, 0x00, "SYSTEM_HISTOGRAM_BIN"),
+    { 0, VL53L0X_REG_GPIO_HV_MUX_ACTIVE_HIGH, 0x01 | VL53L0X_GPIO_ACTIVE_HIGH, VL53L0X_GPIO_ACTIVE_HIGH, 0,
+      on_interrupt_config, "GPIO_HV_MUX_ACTIVE_HIGH" },
+    RW(REG_I2C_MODE, 0x00, "I2C_MODE"),
+    RW(REG_VHV_CONFIG_PAD_SCL_SDA_EXTSUP_HV, 0x00, "VHV_CONFIG_PAD_SCL_SDA__EXTSUP_HV"),
+    { 0, VL53L0X_REG_I2C_SLAVE_DEVICE_ADDRESS, VL53L0X_ADDR, 0x7F, 0, on_address, "I2C_SLAVE_DEVICE_ADDRESS" },
+    RW(REG_GLOBAL_CONFIG_SPAD_ENABLES_REF_0, 0xFF, "GLOBAL_CONFIG_SPAD_ENABLES_REF_0"),
+    RW(REG_GLOBAL_CONFIG_SPAD_ENABLES_REF_0 + 1, 0xFF, "GLOBAL_CONFIG_SPAD_ENABLES_REF_1"),
+    RW(REG_GLOBAL_CONFIG_SPAD_ENABLES_REF_0 + 2, 0xFF, "GLOBAL_CONFIG_SPAD_ENABLES_REF_2"),
+    RW(REG_GLOBAL_CONFIG_SPAD_ENABLES_REF_0 + 3, 0xFF, "GLOBAL_CONFIG_SPAD_ENABLES_REF_3"),
+    RW(REG_GLOBAL_CONFIG_SPAD_ENABLES_REF_0 + 4, 0xFF, "GLOBAL_CONFIG_SPAD_ENABLES_REF_4"),
+    RW(REG_GLOBAL_CONFIG_SPAD_ENABLES_REF_0 + 5, 0x0F, "GLOBAL_CONFIG_SPAD_ENABLES_REF_5"),
+    RW(REG_GLOBAL_CONFIG_REF_EN_START_SELECT, 0x00, "GLOBAL_CONFIG_REF_EN_START_SELECT"),
+    RW(REG_SOFT_RESET_GO2_SOFT_RESET_N, 0x01, "SOFT_RESET_GO2_SOFT_RESET_N"),
+
+    // Identification
+    RO(VL53L0X_REG_IDENTIFICATION_MODEL_ID, VL53L0X_MODEL_ID, "IDENTIFICATION_MODEL_ID"),
+    RO(VL53L0X_REG_IDENTIFICATION_MODEL_ID + 1, 0xAA, "IDENTIFICATION_MODULE_TYPE"),
+    RO(VL53L0X_REG_IDENTIFICATION_REVISION_ID, VL53L0X_REVISION_ID, "IDENTIFICATION_REVISION_ID"),
+    RO(REG_OSC_CALIBRATE_VAL, 0x00, "OSC_CALIBRATE_VAL"),
+    RO(REG_OSC_CALIBRATE_VAL + 1, 0x01, "OSC_CALIBRATE_VAL+1"),  // Timed period is in ms
+
+    // Reachable from every page
+    { 0, REG_POWER_MANAGEMENT_GO1_POWER_FORCE, 0x00, 0xFF, VL53L0X_REG_ALL_PAGES, NULL,
+      "POWER_MANAGEMENT_GO1_POWER_FORCE" },
+    { 0, REG_PAGE_SELECT, 0x00, 0xFF, VL53L0X_REG_ALL_PAGES, on_page_select, "PAGE_SELECT" },
+
+    // Private pages
+    { 1, REG_P1_STOP_VARIABLE, SIM_STOP_VARIABLE, 0x00, 0, NULL, "STOP_VARIABLE" },
+    { 6, REG_P6_NVM_CONTROL, 0x00, 0xFF, 0, NULL, "NVM_CONTROL" },
+    { 7, REG_P7_NVM_CONTROL, 0x00, 0xFF, 0, on_nvm_read, "NVM_READ" },
+    { 7, REG_P7_NVM_ADDRESS, 0x00, 0xFF, 0, NULL, "NVM_ADDRESS" },
+    { 7, REG_P7_SPAD_INFO, SIM_SPAD_INFO, 0x00, 0, NULL, "SPAD_INFO" },
+};
+
+// Drive GPIO1 from the interrupt status: asserted while a new sample is
+// pending in "new sample ready" mode, with the configured polarity. Called
+// with the lock held, so the last update always wins.
+static void drive_interrupt(VL53L0X_Device *dev) {
+    if (!dev->interrupt) {
+        return;
+    }
+
+    int asserted = dev->regs[0][VL53L0X_REG_SYSTEM_INTERRUPT_CONFIG_GPIO] == VL53L0X_INT_NEW_SAMPLE_READY &&
+                   (dev->regs[0][VL53L0X_REG_RESULT_INTERRUPT_STATUS] & VL53L0X_INT_STATUS_MASK);
+    int active_high = (dev->regs[0][VL53L0X_REG_GPIO_HV_MUX_ACTIVE_HIGH] & VL53L0X_GPIO_ACTIVE_HIGH) != 0;
+
+    i2c_aux_write(dev->interrupt, dev->interrupt_pin, asserted == active_high);
+}
+
+// Publish a new sample: the next distance and the data-ready status
+static void complete_measurement(VL53L0X_Device *dev) {
+    dev->distance_mm += dev->distance_step_mm;
+    if (dev->distance_mm > SIM_MAX_DISTANCE_MM) dev->distance_mm = SIM_MIN_DISTANCE_MM;
+    dev->regs[0][VL53L0X_REG_RESULT_RANGE_VAL] = (dev->distance_mm >> 8) & 0xFF;
+    dev->regs[0][VL53L0X_REG_RESULT_RANGE_VAL + 1] = dev->distance_mm & 0xFF;
+    dev->regs[0][VL53L0X_REG_RESULT_INTERRUPT_STATUS] = VL53L0X_INT_NEW_SAMPLE_READY;
+    drive_interrupt(dev);
+}
+
+// Back-to-back or timed ranging is running
+static int ranging_continuous(VL53L0X_Device *dev) {
+    return dev->regs[0][VL53L0X_REG_SYSRANGE_START] & (VL53L0X_SYSRANGE_BACK_TO_BACK | VL53L0X_SYSRANGE_TIMED);
+}
+
+// Time between samples of the running mode: one measurement back-to-back,
+// the inter-measurement period (but at least one measurement) when timed
+static long ranging_period_us(VL53L0X_Device *dev) {
+    const uint8_t *period = &dev->regs[0][VL53L0X_REG_SYSTEM_INTERMEASUREMENT_PERIOD];
+    long period_ms = ((long)period[0] << 24) | (period[1] << 16) | (period[2] << 8) | period[3];
+
+    if (!(dev->regs[0][VL53L0X_REG_SYSRANGE_START] & VL53L0X_SYSRANGE_TIMED) || period_ms * 1000 < RANGING_TIME_US) {
+        return RANGING_TIME_US;
+    }
+    return period_ms * 1000;
+}
+
+static void on_page_select(VL53L0X_Device *dev, uint8_t reg, uint8_t value) {
+    (void)reg;
+    dev->page = value & (VL53L0X_PAGES - 1);
+}
+
+static void on_sysrange_start(VL53L0X_Device *dev, uint8_t reg, uint8_t value) {
+    if (value & VL53L0X_SYSRANGE_SINGLESHOT) {
+        // A single shot completes at once and, as on the device, clears
+        // its start bit, which also stops back-to-back or timed ranging
+        complete_measurement(dev);
+        dev->regs[0][reg] = 0x00;
+        dev->effects |= VL53L0X_WRITE_STARTED;
+    } else if (ranging_continuous(dev)) {
+        pthread_cond_signal(&dev->ranging_cond);
+        dev->effects |= VL53L0X_WRITE_STARTED;
+    }
+}
+
+static void on_interrupt_clear(VL53L0X_Device *dev, uint8_t reg, uint8_t value) {
+    if (value & 0x01) {
+        dev->regs[0][VL53L0X_REG_RESULT_INTERRUPT_STATUS] = 0x00;
+        drive_interrupt(dev);
+    }
+    dev->regs[0][reg] = 0x00;
+}
+
+static void on_interrupt_config(VL53L0X_Device *dev, uint8_t reg, uint8_t value) {
+    (void)reg;
+    (void)value;
+    drive_interrupt(dev);
+}
+
+// Starting an NVM read completes it at once
+static void on_nvm_read(VL53L0X_Device *dev, uint8_t reg, uint8_t value) {
+    (void)value;
+    dev->regs[7][reg] = 0x01;
+}
+
+// The owner of the bus moves the device to the new address
+static void on_address(VL53L0X_Device *dev, uint8_t reg, uint8_t value) {
+    (void)reg;
+    (void)value;
+    dev->effects |= VL53L0X_WRITE_ADDRESS;
+}
+
+// Power-on register values
+static void load_defaults(VL53L0X_Device *dev) {
+    memset(dev->regs, 0, sizeof(dev->regs));
+    for (size_t i = 0; i < sizeof(register_table) / sizeof(register_table[0]); i++) {
+        dev->regs[register_table[i].page][register_table[i].reg] = register_table[i].reset;
+    }
+    dev->page = 0;
+    dev->index = 0;
+}
+
+void vl53l0x_device_init(VL53L0X_Device *dev) {
+    memset(dev->rule, 0, sizeof(dev->rule));
+    for (int page = 0; page < VL53L0X_PAGES; page++) {
+        for (int reg = 0; reg < 256; reg++) {
+            dev->cell[page][reg] = &dev->regs[page][reg];
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(register_table) / sizeof(register_table[0]); i++) {
+        const VL53L0X_RegisterDef *def = &register_table[i];
+
+        if (def->flags & VL53L0X_REG_ALL_PAGES) {
+            for (int page = 0; page < VL53L0X_PAGES; page++) {
+                dev->rule[page][def->reg] = def;
+                dev->cell[page][def->reg] = &dev->regs[def->page][def->reg];
+            }
+        } else {
+            dev->rule[def->page][def->reg] = def;
+        }
+    }
+
+    load_defaults(dev);
+    dev->distance_mm = SIM_INITIAL_DISTANCE_MM;
+    dev->distance_step_mm = SIM_DISTANCE_STEP_MM;
+    dev->effects = 0;
+    dev->interrupt = NULL;
+    dev->interrupt_pin = INT_PIN;
+    pthread_mutex_init(&dev->lock, NULL);
+    pthread_cond_init(&dev->ranging_cond, NULL);
+}
+
+int vl53l0x_device_write(VL53L0X_Device *dev, uint8_t value) {
+    pthread_mutex_lock(&dev->lock);
+    uint8_t reg = dev->index++;
+    const VL53L0X_RegisterDef *def = dev->rule[dev->page][reg];
+    uint8_t *cell = dev->cell[dev->page][reg];
+
+    if (!def) {
+        *cell = value;
+    } else {
+        *cell = (*cell & ~def->write_mask) | (value & def->write_mask);
+        if (def->on_write) {
+            def->on_write(dev, reg, value);
+        }
+    }
+
+    int effects = dev->effects;
+    dev->effects = 0;
+    pthread_mutex_unlock(&dev->lock);
+    return effects;
+}
+
+void vl53l0x_device_reset(VL53L0X_Device *dev) {
+    pthread_mutex_lock(&dev->lock);
+    load_defaults(dev);
+    drive_interrupt(dev);
+    pthread_mutex_unlock(&dev->lock);
+}
+
+uint8_t vl53l0x_device_address(VL53L0X_Device *dev) {
+    pthread_mutex_lock(&dev->lock);
+    uint8_t address = dev->regs[0][VL53L0X_REG_I2C_SLAVE_DEVICE_ADDRESS] & 0x7F;
+    pthread_mutex_unlock(&dev->lock);
+    return address;
+}
+
+void vl53l0x_device_snapshot(VL53L0X_Device *dev, uint8_t *values, size_t count) {
+    pthread_mutex_lock(&dev->lock);
+    for (size_t i = 0; i < count; i++) {
+        values[i] = *dev->cell[dev->page][(uint8_t)(dev->index + i)];
+    }
+    pthread_mutex_unlock(&dev->lock);
+}
+
+void vl53l0x_device_read_done(VL53L0X_Device *dev, size_t count) {
+    pthread_mutex_lock(&dev->lock);
+    dev->index += count;
+    pthread_mutex_unlock(&dev->lock);
+}
+
+void vl53l0x_device_update_interrupt(VL53L0X_Device *dev) {
+    pthread_mutex_lock(&dev->lock);
+    drive_interrupt(dev);
+    pthread_mutex_unlock(&dev->lock);
+}
+
+// Background producer for back-to-back and timed ranging: refreshes the
+// result registers every ranging period until SYSRANGE_START stops it
+static void *ranging_thread(void *arg) {
+    VL53L0X_Device *dev = arg;
+    struct timespec next;
+    sigset_t signals;
+
+    // Leave SIGINT to the main thread, whose blocking waits it interrupts
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    pthread_mutex_lock(&dev->lock);
+    while (dev->running) {
+        if (!ranging_continuous(dev)) {
+            // Idle until started, waking up now and then to see running
+            struct timespec timeout;
+            clock_gettime(CLOCK_REALTIME, &timeout);
+            timeout.tv_nsec += RANGING_IDLE_POLL_US * 1000L;
+            timeout.tv_sec += timeout.tv_nsec / 1000000000L;
+            timeout.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&dev->ranging_cond, &dev->lock, &timeout);
+            clock_gettime(CLOCK_MONOTONIC, &next);
+            continue;
+        }
+
+        // Absolute deadlines, so the sample rate does not drift
+        long period_us = ranging_period_us(dev);
+        next.tv_nsec += period_us % 1000000 * 1000;
+        next.tv_sec += period_us / 1000000 + next.tv_nsec / 1000000000L;
+        next.tv_nsec %= 1000000000L;
+
+        pthread_mutex_unlock(&dev->lock);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        pthread_mutex_lock(&dev->lock);
+
+        if (ranging_continuous(dev)) {
+            complete_measurement(dev);
+        }
+    }
+    pthread_mutex_unlock(&dev->lock);
+    return NULL;
+}
+
+int vl53l0x_device_start(VL53L0X_Device *dev) {
+    dev->running = 1;
+    if (pthread_create(&dev->ranging, NULL, ranging_thread, dev) != 0) {
+        fprintf(stderr, "Failed to start ranging thread\n");
+        return -1;
+    }
+    return 0;
+}
+
+void vl53l0x_device_stop(VL53L0X_Device *dev) {
+    pthread_mutex_lock(&dev->lock);
+    dev->running = 0;
+    pthread_cond_signal(&dev->ranging_cond);
+    pthread_mutex_unlock(&dev->lock);
+    pthread_join(dev->ranging, NULL);
+}
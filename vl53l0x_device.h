@@ -0,0 +1,84 @@
+// vl53l0x_device.h - Virtual VL53L0X register model
+#ifndef VL53L0X_DEVICE_H
+#define VL53L0X_DEVICE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "soft_i2c.h"
+
+#define VL53L0X_PAGES 8  // Register pages selected through 0xFF (0, 1, 6 and 7 are used)
+
+// Register flags
+#define VL53L0X_REG_ALL_PAGES 0x01  // Same register on every page (page select)
+
+// Side effects of a master write, returned by vl53l0x_device_write
+#define VL53L0X_WRITE_STARTED 0x01  // A measurement started
+#define VL53L0X_WRITE_ADDRESS 0x02  // The I2C address changed
+
+typedef struct VL53L0X_Device VL53L0X_Device;
+
+// One entry of the declarative register table. write_mask selects the bits
+// a master write changes (0 makes the register read-only). on_write runs
+// with the device lock held, after the value was stored. Reads have no
+// side effects on the VL53L0X (the interrupt is cleared by a write), so
+// there is no read callback.
+typedef struct {
+    uint8_t page;
+    uint8_t reg;
+    uint8_t reset;
+    uint8_t write_mask;
+    uint8_t flags;
+    void (*on_write)(VL53L0X_Device *dev, uint8_t reg, uint8_t value);
+    const char *name;
+} VL53L0X_RegisterDef;
+
+struct VL53L0X_Device {
+    uint8_t regs[VL53L0X_PAGES][256];
+    // Table entry per register, NULL for plain read/write storage;
+    // built once so an access is a single lookup
+    const VL53L0X_RegisterDef *rule[VL53L0X_PAGES][256];
+    uint8_t *cell[VL53L0X_PAGES][256];  // Storage, shared by all pages where flagged
+    uint8_t page;          // Current page (0xFF)
+    uint8_t index;         // Register index, auto-incremented by transfers
+    uint16_t distance_mm;  // Last simulated range
+    uint16_t distance_step_mm;  // Range change per sample, 10 mm unless set after init
+    int effects;           // VL53L0X_WRITE_* flags set by on_write
+    I2C_Config *interrupt; // Bus driving the GPIO1 interrupt line, NULL when disabled
+    int interrupt_pin;     // GPIO1 line, INT_PIN unless set after init
+    // Back-to-back and timed ranging run in their own thread
+    pthread_mutex_t lock;
+    pthread_cond_t ranging_cond;
+    pthread_t ranging;
+    volatile int running;
+};
+
+// Reset all registers to the table's values and build the dispatch table
+void vl53l0x_device_init(VL53L0X_Device *dev);
+
+// Power-on reset (XSHUT): registers back to the table's values, ranging
+// stopped, address back to VL53L0X_ADDR. The ranging thread keeps running.
+void vl53l0x_device_reset(VL53L0X_Device *dev);
+
+// Current 7-bit I2C address (I2C_SLAVE_DEVICE_ADDRESS)
+uint8_t vl53l0x_device_address(VL53L0X_Device *dev);
+
+// Start and stop the ranging thread
+int vl53l0x_device_start(VL53L0X_Device *dev);
+void vl53l0x_device_stop(VL53L0X_Device *dev);
+
+// Master writes value at the register index, which then advances. Returns
+// its side effects as VL53L0X_WRITE_* flags.
+int vl53l0x_device_write(VL53L0X_Device *dev, uint8_t value);
+
+// Copy count registers from the index on (wrapping), as one consistent
+// sample, without side effects
+void vl53l0x_device_snapshot(VL53L0X_Device *dev, uint8_t *values, size_t count);
+
+// The master read count of them: advance the index
+void vl53l0x_device_read_done(VL53L0X_Device *dev, size_t count);
+
+// Drive GPIO1 from the interrupt status and configuration
+void vl53l0x_device_update_interrupt(VL53L0X_Device *dev);
+
+#endif // VL53L0X_DEVICE_H
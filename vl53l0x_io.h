@@ -5,6 +5,17 @@
 // GPIO pins
 #define SDA_PIN 22                      // GPIO pin for SDA
 #define SCL_PIN 23                      // GPIO pin for SCL
+#define INT_PIN 24                      // GPIO pin for the VL53L0X GPIO1 interrupt output
+#define XSHUT_PIN 4                     // GPIO pin for the first sensor's XSHUT input
+
+// Sensor array on one bus: sensor n has its XSHUT on XSHUT_PIN + n and its
+// GPIO1 on INT_PIN + n, and is moved to VL53L0X_ARRAY_ADDR + n
+#define VL53L0X_MAX_SENSORS 8
+#define VL53L0X_ARRAY_ADDR 0x30
+
+// Buses the slave serves at once (-B), each an SDA/SCL pair with sensors
+// of its own; the aux lines of bus b follow those of bus b - 1
+#define VL53L0X_MAX_BUSES 4
 
 // I2C configuration
 #define VL53L0X_ADDR 0x29               // VL53L0X I2C address
@@ -14,28 +25,57 @@
 #define MEASUREMENT_FREQUENCY_HZ 5       // Measurement frequency in Hz
 #define MAX_MEASUREMENTS 500             // Number of measurements to perform
 #define MEASUREMENT_DELAY_US (1000000 / MEASUREMENT_FREQUENCY_HZ)  // Auto-calculated delay
-#define WRITE_READ_DELAY_US (MEASUREMENT_DELAY_US / 20)  // 5% of measurement period
+#define INT_WAIT_TIMEOUT_US 1000000      // Longest wait for the data-ready interrupt (-i)
+#define SETUP_GAP_US 5000                // Pause between setup writes, covers the slave's pauses
+#define XSHUT_BOOT_US 5000               // Wait after releasing XSHUT (the device boots in 1.2 ms)
+
+// Adaptive bit rate (master -a)
+#define ADAPTIVE_MIN_BIT_DELAY_US 5      // Fastest bit delay the controller may try
+#define ADAPTIVE_MAX_BIT_DELAY_US 10000  // Slowest bit delay it backs off to
 
 // Slave timing constants
 #define START_WAIT_TIMEOUT 100000        // Timeout for waiting START condition
 #define START_WAIT_DELAY 10              // Delay in microseconds for START detection
-#define SCL_STABLE_COUNT 10              // Number of stable SCL readings required
-#define DATA_CHECK_LOOPS 100             // Loops to check for incoming data
 #define RETRY_DELAY_US 1400              // Delay before retry in microseconds
 #define MAX_TRANSACTIONS 10              // Re-sync after this many transactions
 #define MAX_CONSECUTIVE_FAILURES 2       // Force reset after this many failures
 #define POST_TRANSACTION_DELAY_US 500    // Delay after successful transaction
+#define EVENT_POLL_TIMEOUT_US 100000     // Edge event wait per poll (event mode)
+#define RANGING_TIME_US 33000            // Emulated measurement time in back-to-back/timed mode
+#define RANGING_IDLE_POLL_US 100000      // Ranging thread wakeup while no ranging runs
+#define XSHUT_POLL_US 500                // XSHUT input sampling interval
 
 // VL53L0X Register addresses
 #define VL53L0X_REG_IDENTIFICATION_MODEL_ID     0xC0
 #define VL53L0X_REG_IDENTIFICATION_REVISION_ID  0xC2
 #define VL53L0X_REG_SYSRANGE_START              0x00
+#define VL53L0X_REG_SYSTEM_INTERMEASUREMENT_PERIOD 0x04  // 32-bit, milliseconds
+#define VL53L0X_REG_SYSTEM_INTERRUPT_CONFIG_GPIO 0x0A
+#define VL53L0X_REG_SYSTEM_INTERRUPT_CLEAR      0x0B
+#define VL53L0X_REG_GPIO_HV_MUX_ACTIVE_HIGH     0x84
 #define VL53L0X_REG_RESULT_INTERRUPT_STATUS     0x13
 #define VL53L0X_REG_RESULT_RANGE_STATUS         0x14
 #define VL53L0X_REG_RESULT_RANGE_VAL            0x1E
+#define VL53L0X_REG_I2C_SLAVE_DEVICE_ADDRESS    0x8A  // 7-bit, takes effect at once
+
+#define VL53L0X_MAX_WRITE 8  // Longest register burst the master writes
+
+// Result block read in one burst: range status up to the range value
+#define VL53L0X_RESULT_BLOCK_SIZE   (VL53L0X_REG_RESULT_RANGE_VAL + 2 - VL53L0X_REG_RESULT_RANGE_STATUS)
 
 // VL53L0X expected values
 #define VL53L0X_MODEL_ID    0xEE
 #define VL53L0X_REVISION_ID 0x10
+#define VL53L0X_MAX_DISTANCE_MM 8191    // Larger readings can only be corrupted data
+#define VL53L0X_INT_STATUS_MASK 0x07    // Bits above are always zero
+
+// SYSRANGE_START modes; single shot also stops back-to-back and timed ranging
+#define VL53L0X_SYSRANGE_SINGLESHOT   0x01
+#define VL53L0X_SYSRANGE_BACK_TO_BACK 0x02
+#define VL53L0X_SYSRANGE_TIMED        0x04
+
+// Interrupt (GPIO1) configuration
+#define VL53L0X_INT_NEW_SAMPLE_READY 0x04  // CONFIG_GPIO mode and status: measurement done
+#define VL53L0X_GPIO_ACTIVE_HIGH 0x10      // GPIO_HV_MUX_ACTIVE_HIGH polarity bit
 
 #endif // VL53L0X_IO_H
\ No newline at end of file
@@ -5,32 +5,104 @@
 #include <unistd.h>
 #include <signal.h>
 #include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include "soft_i2c.h"
+#include "i2c_rt.h"
+#include "i2c_log.h"
+#include "vl53l0x_device.h"
 #include "vl53l0x_io.h"
 
 volatile int running = 1;
 
-// Virtual device registers
-uint8_t registers[256];
-uint8_t current_reg = 0;
-uint16_t distance_mm = 500;
+// Virtual sensors sharing a bus, each with its own register model
+typedef struct {
+    VL53L0X_Device device;
+    uint8_t address;      // Current I2C address
+    int powered;          // XSHUT released (always, without XSHUT lines)
+    int xshut_pin;        // -1 when not wired
+    unsigned long boots;  // XSHUT releases seen
+} Sensor;
 
-// Forward declaration for SDA mode switching
-static int sda_set_mode(I2C_Config *config, int mode) {
-    gpiod_line_release(config->sda_line);
+// One bus the slave serves: its lines, the sensors on it and the transfer
+// in progress. With several buses each runs in a thread of its own.
+typedef struct {
+    int index;
+    I2C_Config config;
+    I2C_Trace trace;  // Line flight recorder, used when -T is given
+    char trace_prefix[32];
+    char log_prefix[24];
     
-    if (mode == 0) {
-        // Output mode
-        if (gpiod_line_request_output(config->sda_line, "i2c_sda_out", 1) < 0) {
-            return -1;
-        }
+    Sensor sensors[VL53L0X_MAX_SENSORS];
+    
+    // Sensor number + 1 by I2C address, 0 where nobody answers. Read by
+    // the bus on every START; changed under map_lock by address writes
+    // (bus thread) and XSHUT (watcher thread).
+    volatile uint8_t address_map[128];
+    pthread_mutex_t map_lock;
+    pthread_t xshut;
+    int xshut_started;
+    
+    // Device of the transfer in progress, selected by its address byte
+    VL53L0X_Device *device;
+    
+    // Wide bus: sensor n answers on SDA line n, all of them in lockstep,
+    // so every transfer goes to every sensor (1 on a normal bus)
+    int lanes;
+    
+    // Read response, prepared as soon as the register index is known so
+    // the read after the repeated START starts shifting bits right away;
+    // on a wide bus lane n's registers follow at burst + n * I2C_RESPONSE_MAX
+    uint8_t burst[VL53L0X_MAX_SENSORS * I2C_RESPONSE_MAX];
+    I2C_SlaveResponse response;
+    int response_ready;  // Valid for the current register index
+    
+    // Statistics
+    unsigned long transactions;
+    unsigned long failures;  // Transfers that failed after our address
+    unsigned long resyncs;   // Recoveries after the lines moved during failed listens
+    I2C_SlaveDecoder decoder;  // Event mode
+    
+    // Bus thread: started one at a time, then all let go together
+    pthread_t thread;
+    sem_t ready;
+    sem_t go;
+    int status;
+} SlaveBus;
+
+static SlaveBus buses[VL53L0X_MAX_BUSES];
+static I2C_Config *bus_configs[VL53L0X_MAX_BUSES];  // &buses[b].config
+static int bus_count = 1;
+
+// Settings of all buses, from the command line
+static I2C_RtProfile rt;
+static int sensor_count = 1;
+static int xshut_pin = -1;
+static int interrupt = 0;
+static int trace_window_ms = 0;
+static int retry_delay_us = RETRY_DELAY_US;
+static int post_transaction_delay_us = POST_TRANSACTION_DELAY_US;
+static int wide_pins[I2C_WIDE_MAX];  // -W: SDA lines of the wide bus
+static int wide_count = 0;
+
+// Device a transfer reaches on lane n: the addressed one on a normal bus
+static VL53L0X_Device *lane_device(SlaveBus *bus, int n) {
+    return bus->lanes > 1 ? &bus->sensors[n].device : bus->device;
+}
+
+// Snapshot the registers from the index on, so a burst read returns one
+// consistent sample, and load them as the response, each lane's onto its
+// own SDA line (only the first bytes are expanded into bits here)
+static void prepare_response(SlaveBus *bus) {
+    for (int n = 0; n < bus->lanes; n++) {
+        vl53l0x_device_snapshot(lane_device(bus, n), bus->burst + n * I2C_RESPONSE_MAX, I2C_RESPONSE_MAX);
+    }
+    if (bus->lanes > 1) {
+        i2c_slave_response_load_wide(&bus->response, bus->burst, I2C_RESPONSE_MAX, bus->lanes);
     } else {
-        // Input mode  
-        if (gpiod_line_request_input(config->sda_line, "i2c_sda_in") < 0) {
-            return -1;
-        }
+        i2c_slave_response_load(&bus->response, bus->burst, I2C_RESPONSE_MAX);
     }
-    return 0;
+    bus->response_ready = 1;
 }
 
 void handle_signal(int sig) {
@@ -38,25 +110,207 @@ void handle_signal(int sig) {
     running = 0;
 }
 
-// Initialize virtual device registers
-void init_registers(void) {
-    memset(registers, 0, sizeof(registers));
+// Leave SIGINT to the main thread, whose blocking waits it interrupts
+static void block_sigint(void) {
+    sigset_t signals;
+    
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+}
+
+// Recompute the address map from the sensors that are up; on a shared
+// address the lowest sensor wins. Entries change one at a time, so a
+// START meanwhile finds either the old or the new owner. Called with
+// map_lock held.
+static void update_address_map(SlaveBus *bus) {
+    uint8_t map[128] = {0};
+    
+    for (int n = sensor_count - 1; n >= 0; n--) {
+        if (bus->sensors[n].powered) {
+            map[bus->sensors[n].address] = n + 1;
+        }
+    }
+    for (int address = 0; address < 128; address++) {
+        if (bus->address_map[address] != map[address]) {
+            bus->address_map[address] = map[address];
+        }
+    }
+}
+
+// Move a sensor to the address just written to its I2C_SLAVE_DEVICE_ADDRESS.
+// It takes effect at once: the next START already goes to the new address.
+static uint8_t readdress(SlaveBus *bus, Sensor *sensor) {
+    pthread_mutex_lock(&bus->map_lock);
+    sensor->address = vl53l0x_device_address(&sensor->device);
+    update_address_map(bus);
+    pthread_mutex_unlock(&bus->map_lock);
+    return sensor->address;
+}
+
+// Device the last ACKed address byte selected
+static void select_device(SlaveBus *bus) {
+    VL53L0X_Device *selected = &bus->sensors[bus->config.matched - 1].device;
+    
+    // A response prepared for another sensor is of no use
+    if (selected != bus->device) {
+        bus->device = selected;
+        bus->response_ready = 0;
+    }
+}
+
+// Sample the XSHUT inputs. Held low, a sensor is in hardware standby and
+// off the bus; released, it boots with default registers at VL53L0X_ADDR.
+static void *xshut_thread(void *arg) {
+    SlaveBus *bus = arg;
+    
+    block_sigint();
+    
+    while (running) {
+        for (int n = 0; n < sensor_count; n++) {
+            Sensor *sensor = &bus->sensors[n];
+            int level = i2c_aux_read(&bus->config, sensor->xshut_pin);
+            if (level < 0 || level == sensor->powered) {
+                continue;
+            }
+            
+            pthread_mutex_lock(&bus->map_lock);
+            vl53l0x_device_reset(&sensor->device);
+            sensor->address = VL53L0X_ADDR;
+            sensor->powered = level;
+            sensor->boots += level;
+            update_address_map(bus);
+            pthread_mutex_unlock(&bus->map_lock);
+        }
+        usleep(XSHUT_POLL_US);
+    }
+    return NULL;
+}
+
+// Dump the last moments of the bus, if the flight recorder is enabled
+static void trace_failure(I2C_Config *config, const char *reason) {
+    if (config->trace) {
+        i2c_trace_dump(config->trace, reason);
+    }
+}
+
+// Address byte of a repeated START, which may select another sensor
+static int restart(SlaveBus *bus) {
+    int result = i2c_slave_address(&bus->config);
+    
+    if (result >= 0) {
+        select_device(bus);
+    }
+    return result;
+}
+
+// Receive a register write: the register byte, then data bytes stored with
+// auto-increment until the master ends the transfer. Returns the R/W bit
+// if it continues with a repeated START addressed to us, otherwise -1.
+static int handle_write(SlaveBus *bus) {
+    I2C_Config *config = &bus->config;
+    uint8_t byte;
+    
+    bus->response_ready = 0;
+    
+    // Read register address
+    int result = i2c_slave_read_byte_with_stop_check(config, &byte);
+    if (result != 0) {
+        i2c_log(I2C_LOG_INFO, "%s", result == I2C_SLAVE_STOP ? "no register (probe)" : "Failed to read register address");
+        if (result < 0) {
+            bus->failures++;
+            trace_failure(config, "register address not received");
+        }
+        return result == I2C_SLAVE_RESTART ? restart(bus) : -1;
+    }
+    
+    for (int n = 0; n < bus->lanes; n++) {
+        lane_device(bus, n)->index = byte;
+    }
+    
+    // Most register writes are the pointer of a read: get its response
+    // ready while the master sends the repeated START
+    prepare_response(bus);
+    i2c_log(I2C_LOG_INFO, "Reg 0x%02X", byte);
+    
+    // Debug: show if this looks like device address
+    if (byte == VL53L0X_ADDR) {
+        i2c_log(I2C_LOG_INFO, " (WARNING: This is device address, not register!)");
+    }
+    
+    // Data bytes until STOP or repeated START
+    while ((result = i2c_slave_read_byte_with_stop_check(config, &byte)) == 0) {
+        bus->response_ready = 0;
+        i2c_log(I2C_LOG_INFO, " = 0x%02X", byte);
+        int effects = 0;
+        for (int n = 0; n < bus->lanes; n++) {
+            effects |= vl53l0x_device_write(lane_device(bus, n), byte);
+        }
+        if (effects & VL53L0X_WRITE_STARTED) {
+            i2c_log(I2C_LOG_INFO, " (start measurement)");
+        }
+        if (effects & VL53L0X_WRITE_ADDRESS) {
+            uint8_t address = 0;
+            for (int n = 0; n < bus->lanes; n++) {
+                address = readdress(bus, &bus->sensors[bus->lanes > 1 ? n : config->matched - 1]);
+            }
+            i2c_log(I2C_LOG_INFO, " (now at 0x%02X)", address);
+        }
+    }
+    
+    if (result == I2C_SLAVE_RESTART) {
+        return restart(bus);
+    }
+    
+    // A read in a later transaction gets a fresh sample
+    bus->response_ready = 0;
+    if (result < 0) {
+        i2c_log(I2C_LOG_INFO, " - FAILED");
+        bus->failures++;
+        trace_failure(config, "register write failed");
+    }
+    return -1;
+}
+
+// Stream registers from the register index on until the master NACKs.
+// Nothing is logged before the last bit went out; on a wide bus the log
+// shows lane 0.
+static void handle_read(SlaveBus *bus) {
+    I2C_Config *config = &bus->config;
+    uint8_t reg = bus->device->index;
     
-    // Set identification registers
-    registers[VL53L0X_REG_IDENTIFICATION_MODEL_ID] = VL53L0X_MODEL_ID;
-    registers[VL53L0X_REG_IDENTIFICATION_REVISION_ID] = VL53L0X_REVISION_ID;
+    // Without a register write first (or after data bytes) it is prepared
+    // here, while the clock is stretched
+    if (!bus->response_ready) {
+        prepare_response(bus);
+    }
     
-    // Set initial distance
-    registers[VL53L0X_REG_RESULT_RANGE_VAL] = (distance_mm >> 8) & 0xFF;
-    registers[VL53L0X_REG_RESULT_RANGE_VAL + 1] = distance_mm & 0xFF;
+    int sent = i2c_slave_write_response(config, &bus->response);
+    bus->response_ready = 0;
     
-    // Set status registers
-    registers[VL53L0X_REG_RESULT_INTERRUPT_STATUS] = 0x07;  // Data ready
-    registers[VL53L0X_REG_RESULT_RANGE_STATUS] = 0x00;      // Valid range
+    i2c_log(I2C_LOG_INFO, "READ - ");
+    if (sent < 0) {
+        i2c_log(I2C_LOG_INFO, "Reg 0x%02X - FAILED", reg);
+        bus->failures++;
+        trace_failure(config, "register read failed");
+    } else {
+        i2c_log(I2C_LOG_INFO, "Reg 0x%02X = 0x%02X", reg, bus->burst[0]);
+        if (sent > 1) {
+            i2c_log(I2C_LOG_INFO, " ... (%d bytes)", sent);
+        }
+        i2c_log(I2C_LOG_INFO, " - OK");
+        
+        // Register auto-increment, as on the VL53L0X
+        for (int n = 0; n < bus->lanes; n++) {
+            vl53l0x_device_read_done(lane_device(bus, n), sent);
+        }
+    }
+    i2c_log(I2C_LOG_INFO, " (next: 0x%02X)\n", bus->device->index);
     
-    // Initialize all registers to avoid 0xFF
-    for (int i = 0; i < 256; i++) {
-        if (registers[i] == 0) registers[i] = 0x00;
+    // Debug: check line states after transaction
+    if (sent < 0 && i2c_log_level >= I2C_LOG_DEBUG) {
+        i2c_log(I2C_LOG_DEBUG, "DEBUG: Transaction failed, checking line states...\n");
+        i2c_debug_status(config);
     }
 }
 
@@ -68,8 +322,10 @@ int wait_for_start(I2C_Config *config) {
     int idle_detected = 0;
     
     while (timeout < START_WAIT_TIMEOUT) {
-        int sda = gpiod_line_get_value(config->sda_line);
-        int scl = gpiod_line_get_value(config->scl_line);
+        int sda, scl;
+        if (i2c_read_lines(config, &sda, &scl) < 0) {
+            return -1;
+        }
         
         // First, we need to see idle state (both high)
         if (sda == 1 && scl == 1) {
@@ -97,151 +353,541 @@ int wait_for_start(I2C_Config *config) {
     return -1;  // Timeout
 }
 
+// Event-driven transaction state
+typedef struct {
+    SlaveBus *bus;
+    int transaction;
+    int read;       // Current transfer is a read
+    int bytes;      // Bytes received or sent in the current transfer
+    Sensor *sensor; // Addressed sensor
+    uint8_t start_reg;
+    uint8_t snapshot[256];  // Registers from the index on, as of the read's address byte
+} EventTransaction;
 
-int main(int argc, char *argv[]) {
-    (void)argc;
-    (void)argv;
+static int event_address(void *ctx, uint8_t address, int read) {
+    EventTransaction *t = ctx;
+    int match = t->bus->address_map[address];
     
-    I2C_Config config;
-    int transaction_count = 0;
-    int consecutive_failures = 0;
+    if (!match) {
+        return -1;
+    }
+    t->sensor = &t->bus->sensors[match - 1];
+    t->read = read;
+    t->bytes = 0;
+    t->start_reg = t->sensor->device.index;
     
-    signal(SIGINT, handle_signal);
+    // A burst read returns one consistent sample
+    if (read) {
+        vl53l0x_device_snapshot(&t->sensor->device, t->snapshot, sizeof(t->snapshot));
+    }
+    return 0;
+}
+
+static int event_write(void *ctx, uint8_t byte) {
+    EventTransaction *t = ctx;
+    
+    // The first byte of a write selects the register, the rest are data
+    if (t->bytes++ == 0) {
+        t->sensor->device.index = byte;
+        t->start_reg = byte;
+    } else if (vl53l0x_device_write(&t->sensor->device, byte) & VL53L0X_WRITE_ADDRESS) {
+        readdress(t->bus, t->sensor);
+    }
+    return 0;
+}
+
+static uint8_t event_read(void *ctx) {
+    EventTransaction *t = ctx;
     
-    // Configure I2C
-    config.sda_pin = SDA_PIN;
-    config.scl_pin = SCL_PIN;
-    config.slave_address = VL53L0X_ADDR;
-    config.bit_delay = I2C_BIT_DELAY_US;
+    return t->snapshot[(uint8_t)t->bytes++];
+}
+
+static void event_stop(void *ctx) {
+    EventTransaction *t = ctx;
     
-    // Initialize I2C as slave
-    if (i2c_init_slave(&config) < 0) {
-        fprintf(stderr, "Failed to initialize I2C slave\n");
-        return 1;
+    t->transaction++;
+    t->bus->transactions++;
+    i2c_log(I2C_LOG_INFO, "Transaction %d: 0x%02X %s - Reg 0x%02X, %d byte(s)\n", t->transaction,
+            t->sensor->address, t->read ? "READ" : "WRITE", t->start_reg, t->bytes);
+    if (t->read) {
+        vl53l0x_device_read_done(&t->sensor->device, t->bytes);
     }
+}
+
+// Decode transactions from line edge events instead of polling the lines
+static int run_event_loop(SlaveBus *bus) {
+    static const I2C_SlaveHandler handler = {
+        .address = event_address,
+        .write = event_write,
+        .read = event_read,
+        .stop = event_stop,
+    };
+    I2C_Config *config = &bus->config;
+    I2C_SlaveDecoder *decoder = &bus->decoder;
+    EventTransaction transaction = { .bus = bus, .sensor = &bus->sensors[0] };
     
-    // Initialize virtual device
-    init_registers();
+    i2c_decoder_init(decoder, &handler, &transaction);
     
-    printf("VL53L0X Fixed Slave Started\n");
-    printf("Using SDA: GPIO%d, SCL: GPIO%d, Address: 0x%02X\n", 
-           config.sda_pin, config.scl_pin, config.slave_address);
-    printf("Model ID: 0x%02X, Revision ID: 0x%02X\n", VL53L0X_MODEL_ID, VL53L0X_REVISION_ID);
-    printf("Initial distance: %d mm\n\n", distance_mm);
+    while (running) {
+        unsigned long timeouts = decoder->timeouts;
+        if (i2c_slave_poll_events(config, decoder, EVENT_POLL_TIMEOUT_US) < 0) {
+            fprintf(stderr, "Backend %s does not support edge events\n", config->ops->name);
+            return -1;
+        }
+        if (decoder->timeouts != timeouts) {
+            bus->failures++;
+            trace_failure(config, "transfer abandoned mid-byte");
+        }
+    }
+    return 0;
+}
+
+// Poll the lines for one transaction after another
+static int run_polling_loop(SlaveBus *bus) {
+    I2C_Config *config = &bus->config;
+    int consecutive_failures = 0;
+    int desync = 0;
     
     while (running) {
         // Sync pause before listening
-        usleep(RETRY_DELAY_US);
+        usleep(retry_delay_us);
         
         // Listen for transaction
-        int result = i2c_slave_listen(&config);
+        int result = i2c_slave_listen(config);
         if (result < 0) {
-            // No valid transaction detected
+            // No valid transaction detected. On an idle bus that is just
+            // a timeout; if the lines moved, we lost track of a transfer.
             consecutive_failures++;
+            desync |= result == I2C_SLAVE_LOST;
             if (consecutive_failures >= MAX_CONSECUTIVE_FAILURES) {
-                printf("Too many failures, forcing bus recovery...\n");
+                i2c_log(I2C_LOG_INFO, "Too many failures, forcing bus recovery...\n");
+                if (desync) {
+                    bus->resyncs++;
+                    trace_failure(config, "resync after failed transfers");
+                    desync = 0;
+                }
                 // Wait for bus to be idle
-                usleep(RETRY_DELAY_US * 10);
+                usleep(retry_delay_us * 10);
                 consecutive_failures = 0;
             }
-            usleep(RETRY_DELAY_US);
+            usleep(retry_delay_us);
             continue;
         }
         
         // Reset failure counter on success
         consecutive_failures = 0;
+        desync = 0;
         
-        transaction_count++;
-        printf("Transaction %d: ", transaction_count);
+        select_device(bus);
+        bus->transactions++;
+        i2c_log(I2C_LOG_INFO, "Transaction %lu: 0x%02X ", bus->transactions,
+                bus->sensors[config->matched - 1].address);
         
-        if (result == 0) {  // Write mode
-            printf("WRITE - ");
-            
-            // Read register address
-            int byte_result = i2c_slave_read_byte(&config);
-            if (byte_result < 0) {
-                printf("Failed to read register address\n");
-                continue;
+        // A repeated START chains another transfer onto this transaction
+        while (result == 0) {  // Write mode
+            i2c_log(I2C_LOG_INFO, "WRITE - ");
+            result = handle_write(bus);
+            if (result >= 0) {
+                i2c_log(I2C_LOG_INFO, ", repeated START - ");
             }
-            
-            current_reg = (uint8_t)byte_result;
-            printf("Reg 0x%02X", current_reg);
-            
-            // Debug: show if this looks like device address
-            if (current_reg == VL53L0X_ADDR) {
-                printf(" (WARNING: This is device address, not register!)");
+        }
+        
+        if (result == 1) {  // Read mode
+            handle_read(bus);
+        } else {
+            i2c_log(I2C_LOG_INFO, "\n");
+        }
+        
+        // Ensure SDA and SCL are released for next transaction
+        i2c_release_sda(config);
+        i2c_slave_release_scl(config);
+        
+        // Small pause after successful transaction
+        usleep(post_transaction_delay_us);
+    }
+    return 0;
+}
+
+// Stop the first count ranging threads and the XSHUT watcher, if started,
+// and report where the sensors ended up
+static void stop_sensors(SlaveBus *bus, int count) {
+    if (bus->xshut_started) {
+        pthread_join(bus->xshut, NULL);
+        bus->xshut_started = 0;
+    }
+    for (int n = 0; n < count; n++) {
+        Sensor *sensor = &bus->sensors[n];
+        vl53l0x_device_stop(&sensor->device);
+        if (sensor->xshut_pin >= 0) {
+            printf("%sSensor %d: %s at 0x%02X, %lu boot(s)\n", bus->log_prefix, n,
+                   sensor->powered ? "up" : "in reset", sensor->address, sensor->boots);
+        }
+    }
+}
+
+// Bring up a bus: real-time profile of its thread, lines, sensors
+static int bus_start(SlaveBus *bus) {
+    I2C_Config *config = &bus->config;
+    I2C_RtProfile bus_rt = rt;
+    
+    // Real-time profile before init, so the delay engine calibrates under it
+    bus_rt.cpu = i2c_rt_thread_cpu(&rt, bus->index);
+    if (i2c_rt_apply(&bus_rt) < 0) {
+        return -1;
+    }
+    
+    if (trace_window_ms > 0) {
+        if (i2c_trace_init(&bus->trace, bus->trace_prefix, trace_window_ms) < 0) {
+            return -1;
+        }
+        config->trace = &bus->trace;
+    }
+    
+    // Initialize I2C as slave
+    if (i2c_init_slave(config) < 0) {
+        fprintf(stderr, "Failed to initialize I2C slave\n");
+        return -1;
+    }
+    
+    // Initialize virtual devices. Without XSHUT lines they are up from
+    // the start; with them, the watcher brings them up on its first pass.
+    // Sensor n of bus b has the lines of sensor b * sensor_count + n.
+    pthread_mutex_init(&bus->map_lock, NULL);
+    bus->device = &bus->sensors[0].device;
+    for (int n = 0; n < sensor_count; n++) {
+        Sensor *sensor = &bus->sensors[n];
+        int line = bus->index * sensor_count + n;
+        
+        vl53l0x_device_init(&sensor->device);
+        sensor->address = VL53L0X_ADDR;
+        
+        // Each lane of a wide bus ranges on its own: lane n's distance
+        // moves n + 1 times as fast, so the master can tell them apart
+        if (bus->lanes > 1) {
+            sensor->device.distance_step_mm *= n + 1;
+        }
+        sensor->powered = xshut_pin < 0;
+        sensor->xshut_pin = xshut_pin < 0 ? -1 : xshut_pin + line;
+        
+        if (sensor->xshut_pin >= 0 && i2c_aux_open(config, sensor->xshut_pin, I2C_DIR_IN) < 0) {
+            fprintf(stderr, "Failed to set up XSHUT input on GPIO%d\n", sensor->xshut_pin);
+            i2c_cleanup(config);
+            return -1;
+        }
+        
+        // Interrupt output, inactive until a measurement completes
+        if (interrupt) {
+            sensor->device.interrupt_pin = INT_PIN + line;
+            if (i2c_aux_open(config, INT_PIN + line, I2C_DIR_OUT) < 0) {
+                fprintf(stderr, "Failed to set up interrupt output on GPIO%d\n", INT_PIN + line);
+                i2c_cleanup(config);
+                return -1;
             }
-            
-            // For SYSRANGE_START, try to read value
-            if (current_reg == VL53L0X_REG_SYSRANGE_START) {
-                // Check for more data with very short timeout
-                int scl_stable = 0;
-                for (int i = 0; i < DATA_CHECK_LOOPS; i++) {
-                    if (gpiod_line_get_value(config.scl_line) == 0) {
-                        scl_stable++;
-                        if (scl_stable > SCL_STABLE_COUNT) {
-                            // Clock is low, might be data coming
-                            byte_result = i2c_slave_read_byte(&config);
-                            if (byte_result >= 0) {
-                                uint8_t value = (uint8_t)byte_result;
-                                registers[current_reg] = value;
-                                printf(" = 0x%02X", value);
-                                
-                                if (value & 0x01) {
-                                    printf(" (start measurement)");
-                                    // Update distance
-                                    distance_mm += 10;
-                                    if (distance_mm > 1000) distance_mm = 100;
-                                    registers[VL53L0X_REG_RESULT_RANGE_VAL] = (distance_mm >> 8) & 0xFF;
-                                    registers[VL53L0X_REG_RESULT_RANGE_VAL + 1] = distance_mm & 0xFF;
-                                }
-                            }
-                            break;
-                        }
-                    } else {
-                        scl_stable = 0;
-                    }
-                    usleep(10);
-                }
+            sensor->device.interrupt = config;
+            vl53l0x_device_update_interrupt(&sensor->device);
+        }
+    }
+    update_address_map(bus);
+    
+    for (int n = 0; n < sensor_count; n++) {
+        if (vl53l0x_device_start(&bus->sensors[n].device) < 0) {
+            stop_sensors(bus, n);
+            i2c_cleanup(config);
+            return -1;
+        }
+    }
+    if (xshut_pin >= 0) {
+        if (pthread_create(&bus->xshut, NULL, xshut_thread, bus) != 0) {
+            fprintf(stderr, "Failed to start XSHUT watcher\n");
+            stop_sensors(bus, sensor_count);
+            i2c_cleanup(config);
+            return -1;
+        }
+        bus->xshut_started = 1;
+    }
+    
+    printf("%sUsing SDA: GPIO%d, SCL: GPIO%d, Address: 0x%02X\n", bus->log_prefix,
+           config->sda_pin, config->scl_pin, config->slave_address);
+    if (bus->lanes > 1) {
+        printf("%sSensors: %d in lockstep, one per SDA line\n", bus->log_prefix, bus->lanes);
+    }
+    if (xshut_pin >= 0) {
+        printf("%sSensors: %d, XSHUT on GPIO%d-%d\n", bus->log_prefix, sensor_count,
+               bus->sensors[0].xshut_pin, bus->sensors[sensor_count - 1].xshut_pin);
+    }
+    return 0;
+}
+
+static int bus_loop(SlaveBus *bus) {
+    return bus->config.edge_events ? run_event_loop(bus) : run_polling_loop(bus);
+}
+
+// Tear a bus down and print its statistics
+static void bus_stop(SlaveBus *bus) {
+    I2C_SlaveDecoder *decoder = &bus->decoder;
+    
+    stop_sensors(bus, sensor_count);
+    if (bus->config.edge_events) {
+        printf("%sDecoder: %lu edges, %lu STARTs, %lu STOPs, %lu timeouts\n", bus->log_prefix,
+               decoder->edges, decoder->starts, decoder->stops, decoder->timeouts);
+    }
+    if (bus_count > 1) {
+        printf("%s%lu transactions, %lu failed, %lu resyncs\n", bus->log_prefix,
+               bus->transactions, bus->failures, bus->resyncs);
+    }
+    i2c_cleanup(&bus->config);
+    i2c_trace_free(&bus->trace);
+}
+
+// Thread of one of several buses: brought up while the main thread waits,
+// serving once all are up
+static void *bus_thread(void *arg) {
+    SlaveBus *bus = arg;
+    
+    block_sigint();
+    i2c_log_thread(bus->log_prefix);
+    
+    bus->status = bus_start(bus);
+    sem_post(&bus->ready);
+    if (bus->status < 0) {
+        return NULL;
+    }
+    
+    sem_wait(&bus->go);
+    bus->status = bus_loop(bus);
+    return NULL;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-b gpiod|gpiomem|sim] [-d device] [-B sda:scl,...] [-W sda,...]\n"
+                    "          [-t us] [-y us] [-P us] [-e] [-S] [-i] [-N sensors] [-X pin]\n"
+                    "          [-v level] [-T ms] [-r|-R] [-p prio] [-c cpu]\n", prog);
+    fprintf(stderr, "  -b  Line backend (default: gpiod)\n");
+    fprintf(stderr, "  -d  Backend device: gpiochip, GPIO register block (a regular file\n");
+    fprintf(stderr, "      is used as a fake one) or simulated wire file\n");
+    fprintf(stderr, "  -B  Serve 1-%d buses at once, each on its SDA:SCL pin pair and in a\n",
+            VL53L0X_MAX_BUSES);
+    fprintf(stderr, "      thread of its own (default: %d:%d)\n", SDA_PIN, SCL_PIN);
+    fprintf(stderr, "  -W  Wide bus: one sensor at 0x%02X on each of 2-%d SDA lines sharing\n",
+            VL53L0X_ADDR, I2C_WIDE_MAX);
+    fprintf(stderr, "      SCL GPIO%d, all answering the same transfers (polling only)\n", SCL_PIN);
+    fprintf(stderr, "  -t  Bit delay in microseconds (default: %d)\n", I2C_BIT_DELAY_US);
+    fprintf(stderr, "  -y  Retry delay in microseconds (default: %d)\n", RETRY_DELAY_US);
+    fprintf(stderr, "  -P  Post-transaction delay in microseconds (default: %d)\n", POST_TRANSACTION_DELAY_US);
+    fprintf(stderr, "  -r  Real-time profile: SCHED_FIFO, locked memory, CPU affinity and\n");
+    fprintf(stderr, "      minimal timer slack; warn about what cannot be obtained\n");
+    fprintf(stderr, "  -R  Like -r, but fail if any of it cannot be obtained\n");
+    fprintf(stderr, "  -p  SCHED_FIFO priority (default: %d)\n", I2C_RT_DEFAULT_PRIORITY);
+    fprintf(stderr, "  -c  CPU to run on, bus n on CPU + n (default: isolcpus cores, if any)\n");
+    fprintf(stderr, "  -S  Do not stretch the clock while preparing a response\n");
+    fprintf(stderr, "  -e  Decode edge events instead of polling the lines (gpiod, sim)\n");
+    fprintf(stderr, "  -i  Drive the data-ready interrupt (GPIO1) on GPIO%d (+ sensor)\n", INT_PIN);
+    fprintf(stderr, "  -N  Emulate 1-%d sensors per bus, all booting at 0x%02X (default: 1)\n",
+            VL53L0X_MAX_SENSORS, VL53L0X_ADDR);
+    fprintf(stderr, "  -X  Sensor n is held in reset while GPIO<pin + n> (XSHUT) is low;\n");
+    fprintf(stderr, "      required for more than one sensor (default pin: %d)\n", XSHUT_PIN);
+    fprintf(stderr, "  -v  Log level: %d errors, %d transactions, %d debug (default: %d)\n",
+            I2C_LOG_ERROR, I2C_LOG_INFO, I2C_LOG_DEBUG, I2C_LOG_INFO);
+    fprintf(stderr, "  -T  Record SDA/SCL and dump the last ms milliseconds before each\n");
+    fprintf(stderr, "      failure to vl53l0x_slave_<pid>_<n>.vcd (_bus<b>_ with -B)\n");
+}
+
+int main(int argc, char *argv[]) {
+    I2C_Config defaults;
+    int stretch = 1;
+    int log_level = I2C_LOG_INFO;
+    int bit_delay = I2C_BIT_DELAY_US;
+    int started = 0;
+    int result = 0;
+    
+    signal(SIGINT, handle_signal);
+    
+    memset(&defaults, 0, sizeof(defaults));
+    i2c_rt_defaults(&rt);
+    for (int b = 0; b < VL53L0X_MAX_BUSES; b++) {
+        bus_configs[b] = &buses[b].config;
+    }
+    buses[0].config.sda_pin = SDA_PIN;
+    buses[0].config.scl_pin = SCL_PIN;
+    
+    int opt;
+    while ((opt = getopt(argc, argv, "b:d:B:W:t:y:P:eSN:X:iv:T:rRp:c:h")) != -1) {
+        switch (opt) {
+        case 'b':
+            if (i2c_set_backend(&defaults, optarg) < 0) {
+                return 1;
             }
-            printf("\n");
-            
-        } else if (result == 1) {  // Read mode
-            printf("READ - ");
-            
-            // Send register value using fixed function
-            uint8_t value = registers[current_reg];
-            printf("Reg 0x%02X = 0x%02X", current_reg, value);
-            
-            int write_result = i2c_slave_write_byte(&config, value);
-            if (write_result < 0) {
-                printf(" - FAILED");
-            } else {
-                printf(" - OK");
+            break;
+        case 'd':
+            defaults.device = optarg;
+            break;
+        case 'B':
+            if ((bus_count = i2c_parse_buses(optarg, bus_configs, VL53L0X_MAX_BUSES)) < 0) {
+                return 1;
             }
-            
-            // Always increment for VL53L0X multi-byte reads
-            current_reg++;
-            printf(" (next: 0x%02X)\n", current_reg);
-            
-            // Debug: check line states after transaction
-            if (write_result < 0) {
-                printf("DEBUG: Transaction failed, checking line states...\n");
-                i2c_debug_status(&config);
+            break;
+        case 'W':
+            if ((wide_count = i2c_parse_wide(optarg, wide_pins)) < 0) {
+                return 1;
             }
+            break;
+        case 'r':
+        case 'R':
+            rt.enabled = 1;
+            rt.required |= opt == 'R';
+            break;
+        case 'p':
+            rt.priority = atoi(optarg);
+            break;
+        case 'c':
+            rt.cpu = atoi(optarg);
+            break;
+        case 't':
+            bit_delay = atoi(optarg);
+            break;
+        case 'y':
+            retry_delay_us = atoi(optarg);
+            break;
+        case 'P':
+            post_transaction_delay_us = atoi(optarg);
+            break;
+        case 'e':
+            defaults.edge_events = 1;
+            break;
+        case 'S':
+            stretch = 0;
+            break;
+        case 'i':
+            interrupt = 1;
+            break;
+        case 'N':
+            sensor_count = atoi(optarg);
+            break;
+        case 'X':
+            xshut_pin = atoi(optarg);
+            break;
+        case 'v':
+            log_level = atoi(optarg);
+            break;
+        case 'T':
+            trace_window_ms = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    
+    if (sensor_count < 1 || sensor_count > VL53L0X_MAX_SENSORS) {
+        fprintf(stderr, "Sensors must be 1-%d\n", VL53L0X_MAX_SENSORS);
+        return 1;
+    }
+    // The sensors of a wide bus are told apart by their SDA lines instead
+    if (wide_count > 0) {
+        if (bus_count > 1 || sensor_count > 1 || xshut_pin >= 0 || interrupt || defaults.edge_events) {
+            fprintf(stderr, "A wide bus (-W) cannot be combined with -B, -N, -X, -i or -e\n");
+            return 1;
         }
+        sensor_count = wide_count;
+        buses[0].config.width = wide_count;
+        memcpy(buses[0].config.sda_pins, wide_pins, sizeof(wide_pins));
+    }
+    
+    // They all boot at the same address, only XSHUT tells them apart
+    if (sensor_count > 1 && xshut_pin < 0 && wide_count == 0) {
+        xshut_pin = XSHUT_PIN;
+    }
+    
+    // Configure I2C: the same settings on every bus, only the pins differ
+    for (int b = 0; b < bus_count; b++) {
+        SlaveBus *bus = &buses[b];
+        I2C_Config *config = &bus->config;
         
-        // Ensure we're back in input mode for next transaction
-        if (sda_set_mode(&config, 1) < 0) {
-            printf("ERROR: Failed to set SDA to input mode\n");
+        bus->index = b;
+        bus->lanes = config->width > 1 ? config->width : 1;
+        config->ops = defaults.ops;
+        config->device = defaults.device;
+        config->edge_events = defaults.edge_events;
+        config->slave_address = VL53L0X_ADDR;
+        config->address_map = bus->address_map;
+        config->bit_delay = bit_delay;
+        config->clock_stretch = stretch;
+        if (bus_count > 1) {
+            snprintf(bus->trace_prefix, sizeof(bus->trace_prefix), "vl53l0x_slave_bus%d", b);
+            snprintf(bus->log_prefix, sizeof(bus->log_prefix), "[bus %d] ", b);
+        } else {
+            snprintf(bus->trace_prefix, sizeof(bus->trace_prefix), "vl53l0x_slave");
+        }
+    }
+    
+    // Sensor n of bus b has the aux lines of sensor b * sensor_count + n,
+    // none of which may land on a bus line
+    int lines = bus_count * sensor_count;
+    if ((xshut_pin >= 0 && i2c_check_aux_pins(bus_configs, bus_count, xshut_pin, lines, "XSHUT") < 0) ||
+        (interrupt && i2c_check_aux_pins(bus_configs, bus_count, INT_PIN, lines, "INT") < 0)) {
+        return 1;
+    }
+    
+    printf("VL53L0X Fixed Slave Started\n");
+    printf("Model ID: 0x%02X, Revision ID: 0x%02X\n", VL53L0X_MODEL_ID, VL53L0X_REVISION_ID);
+    
+    // A single bus is served by the main thread
+    if (bus_count == 1) {
+        if (bus_start(&buses[0]) < 0) {
+            return 1;
         }
+        printf("Initial distance: %d mm\n\n", buses[0].sensors[0].device.distance_mm);
         
-        // Small pause after successful transaction
-        usleep(POST_TRANSACTION_DELAY_US);
+        // From here on the bus loop only queues its messages
+        i2c_log_start(log_level);
+        result = bus_loop(&buses[0]);
+        i2c_log_stop();
+        
+        printf("\nCleaning up...\n");
+        bus_stop(&buses[0]);
+        return result < 0 ? 1 : 0;
+    }
+    
+    // Bring the buses up one after the other, so their setup output does
+    // not interleave, then let all of them go at once
+    for (started = 0; started < bus_count; started++) {
+        SlaveBus *bus = &buses[started];
+        
+        sem_init(&bus->ready, 0, 0);
+        sem_init(&bus->go, 0, 0);
+        if (pthread_create(&bus->thread, NULL, bus_thread, bus) != 0) {
+            fprintf(stderr, "Failed to start thread for bus %d\n", started);
+            result = -1;
+            break;
+        }
+        sem_wait(&bus->ready);
+        if (bus->status < 0) {
+            pthread_join(bus->thread, NULL);
+            result = -1;
+            break;
+        }
+    }
+    if (result < 0) {
+        running = 0;
+    } else {
+        printf("Initial distance: %d mm\n\n", buses[0].sensors[0].device.distance_mm);
+    }
+    
+    // From here on the bus threads only queue their messages
+    i2c_log_start(log_level);
+    for (int b = 0; b < started; b++) {
+        sem_post(&buses[b].go);
+    }
+    for (int b = 0; b < started; b++) {
+        pthread_join(buses[b].thread, NULL);
+        result |= buses[b].status;
     }
+    i2c_log_stop();
     
     printf("\nCleaning up...\n");
-    i2c_cleanup(&config);
+    for (int b = 0; b < started; b++) {
+        bus_stop(&buses[b]);
+    }
     
-    return 0;
-}
\ No newline at end of file
+    return result < 0 ? 1 : 0;
+}